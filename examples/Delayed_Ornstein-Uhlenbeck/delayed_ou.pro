@@ -10,6 +10,7 @@ greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
 TARGET = delayed_ou
 TEMPLATE = app
+CONFIG += thread
 
 DEFINES += O2SCL_CPP11
 
@@ -25,7 +26,7 @@ HEADERS += \
     ou_process.h \
     standardwindow.h
 
-QMAKE_CXXFLAGS += -std=gnu++0x
+QMAKE_CXXFLAGS += -std=gnu++17
 # This might be a gcc only flag
 #CONFIG(release, debug|release): QMAKE_CXXFLAG += -g -O2
 
@@ -41,7 +41,10 @@ public:
       XSeries(varname), XProbabilityDensity(estimated_snapshots) {}
     void update(double t, const XVector& x) {
       XSeries::update(t, x);
-      XProbabilityDensity::update(t,x);
+      if (XSeries::last_recorded()) {
+        // Only keep densities at the recorded time points (see History::set_recording)
+        XProbabilityDensity::update(t,x);
+      }
     }
     void reset() {
       XSeries::reset();
@@ -94,7 +97,7 @@ public:
    ********************************************************/
   XVector drift(double t, const XVector& x, const XHistory& history) const {
     // const is required to accept temporaries
-    static XVector x_out;
+    XVector x_out;
     x_out(0) = alpha.value * history(t - tau.value)(0);
     for (int n = 1; n <= n_modes; ++n) {
       //x_out(2*n - 1) = lambda(n).real() * x(2*n - 1);
@@ -114,7 +117,7 @@ public:
   typename frantic::GaussianWhiteNoise<double> generator1;
 
   DiffusionCoeff diffusion_coeffs(double t, const XVector& x, const XHistory& history) const {
-    static XVector x_out;
+    XVector x_out;
     x_out(0) = sqrt(2*D.value);
     for (int n=1; n <= n_modes; ++n) {
       //x_out(2*n - 1) = sqrt(2*D.value) * (K(n).real() * cos(x(2*n))
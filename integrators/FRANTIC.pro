@@ -6,24 +6,40 @@
 
 TARGET = FRANTIC
 TEMPLATE = lib
-CONFIG += staticlib
+CONFIG += staticlib thread   # thread: io.cpp uses std::thread for background writers
 
-QMAKE_CXXFLAGS += -std=c++11
+QMAKE_CXXFLAGS += -std=c++17
 
 DEFINES += O2SCL_CPP11
 
 SOURCES += \
     integrator.tpp \
     history.tpp \
+    storage.tpp \
     histcollection.tpp \
+    RK4.tpp \
     io.cpp \
 
 HEADERS += \
     integrator.h \
     history.h \
+    storage.h \
+    sinks.h \
+    parallel.h \
+    montecarlo.h \
+    sweep.h \
+    statistics.h \
     euler.h \
     euler_sttic.h \
+    milstein_sttic.h \
+    sra_sttic.h \
+    implicit_euler_sttic.h \
+    RK4.h \
     rkf45_gsl.h \
+    dopri5.h \
+    implicit.h \
+    rosenbrock.h \
+    bdf.h \
     histcollection.h \
     stochastic.h \
     io.h
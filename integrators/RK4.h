@@ -1,33 +1,47 @@
-/* 4th order Runge-Kutta ODE solver
+/* 4th order Runge-Kutta integrator
  */
 
 #ifndef RK4_H
 #define RK4_H
 
-#include "solver.h"
+#include "integrator.h"
 
 using std::vector;
 
-namespace solvers {
-
-template <typename Functor, typename XVector>
-class RK4 : public Solver<Functor, XVector>
-{
-public:
-    RK4<Functor, XVector>() {}
+namespace integrators {
+
+  /* Classic 4th order Runge-Kutta integrator with fixed step, for delayed (or ordinary)
+   * differential equations, with the same interface as Euler_sttic: stages are evaluated
+   * with dX.drift(t, x, history), delayed values coming from the history's interpolation.
+   * The step is the history's dt, which must not exceed the shortest registered delay (the
+   * stages would otherwise need the solution within the step itself; use RKF45_gsl or
+   * DOPRI5 for that).
+   * The derivative at the end of each step is the first stage of the next one; it is
+   * recorded with the step, so histories with dense output interpolate lookups between rows
+   * to the same order as the integration (see InterpolatedSeries::update(t, x, dxdt)).
+   */
+  template <class Differential>
+  class RK4 : public frantic::Integrator<Differential>
+  {
+  private:
+    using XVector = typename Differential::XVector;
+
+  public:
+
+    using frantic::Integrator<Differential>::Integrator;  // Allow parent class overloads
+    RK4<Differential>() : frantic::Integrator<Differential>() {
+      this->order = 4;
+    }
     virtual ~RK4() {}
-    void solve();
-
-private:
-    ODETypes::NOISE_SHAPE noiseShape = ODETypes::NOISE_NONE;
-
-    // required because this a template function
-    using Solver<Functor, XVector>::series_t;
-    using Solver<Functor, XVector>::series_x;
-    using Solver<Functor, XVector>::tStepSize;
-    using Solver<Functor, XVector>::tNumSteps;
-    using Solver<Functor, XVector>::ode;
-};
+
+    void integrate(const Differential& dX);
+
+  private:
+    /// \name Storage for the intermediate steps
+    //@{
+    XVector k2, k3, k4;
+    //@}
+  };
 
 #include "RK4.tpp"
 
@@ -1,36 +1,33 @@
-/* 4th order Runge-Kutta ODE solver
- */
-
-#ifndef RK4_H
-#define RK4_H
-
-#include "solver.h"
-
-using std::vector;
-
-namespace solvers {
-
-template <typename Functor, typename XVector>
-class RK4 : public Solver<Functor, XVector>
-{
-public:
-    RK4<Functor, XVector>() {}
-    virtual ~RK4() {}
-    void solve();
-
-private:
-    ODETypes::NOISE_SHAPE noiseShape = ODETypes::NOISE_NONE;
-
-    // required because this a template function
-    using Solver<Functor, XVector>::series_t;
-    using Solver<Functor, XVector>::series_x;
-    using Solver<Functor, XVector>::tStepSize;
-    using Solver<Functor, XVector>::tNumSteps;
-    using Solver<Functor, XVector>::ode;
-};
-
-#include "RK4.tpp"
-
+#ifndef RK4_TPP
+#define RK4_TPP
+
+/* Given a total derivative functor dX, integrate the DE problem from t0 to tn with steps dt */
+template <class Differential>
+void RK4<Differential>::integrate(const Differential& dX) {
+  auto& history = this->history;
+
+  assert(history.check_initialized());
+  if (history.dt > history.get_min_delay()) {
+    std::cerr << "RK4: the time step (" << history.dt << ") is longer than the shortest delay ("
+              << history.get_min_delay() << ")." << std::endl;
+    assert(false);
+  }
+
+  const double dt = history.dt;
+  double t = history.t0;
+  XVector x = history(t);
+  XVector dxdt = dX.drift(t, x, history);   // k1 of the first step
+  this->record_initial_slope(dxdt);
+
+  for (ptrdiff_t i=0; i < history.nSteps; ++i) {   // nSteps is the number of steps from t0 to tn
+    k2 = dX.drift(t + 0.5 * dt, x + (0.5 * dt) * dxdt, history);
+    k3 = dX.drift(t + 0.5 * dt, x + (0.5 * dt) * k2, history);
+    k4 = dX.drift(t + dt, x + dt * k3, history);
+    x += (dt / 6.0) * (dxdt + 2.0 * (k2 + k3) + k4);
+    t += dt;
+    dxdt = dX.drift(t, x, history);        // Only looks up times before t, so the row can be added after
+    this->record_step(t, x, dxdt);
+  }
 }
 
-#endif // RK4_H
\ No newline at end of file
+#endif // RK4_TPP
@@ -0,0 +1,288 @@
+#ifndef BDF_H
+#define BDF_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <deque>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include "integrator.h"
+#include "implicit.h"
+
+using std::vector;
+
+namespace integrators {
+
+
+  /* Variable order (1 to 5), variable step backward differentiation formulas, for stiff
+   * delayed (or ordinary) differential equations. Same interface as RKF45_gsl.
+   *
+   * The formulas are those for equally spaced points: when the step changes, the previous
+   * values are interpolated at the new spacing. Each step solves the implicit equation with
+   * a simplified Newton iteration, starting from the extrapolation of the previous values;
+   * the Jacobian (see frantic::Linearization) is kept across steps, and only recomputed when
+   * the iteration fails to converge or every 'jacobian_age' steps, and the LU factorization
+   * of I - h*beta*J is only recomputed when h or the order change. To keep those changes
+   * rare, the step is only increased if it can grow by at least 20%, and the order and step
+   * are only reconsidered after order + 1 steps without a change.
+   * The error of a step is estimated from the difference between the solution and its
+   * extrapolation; the error at the neighbouring orders from the backward differences of the
+   * previous values, and the order allowing the longest step is chosen.
+   * Steps end exactly on the critical points of the history and on tn, and are never longer
+   * than the shortest delay. After a critical point the method restarts at order 1, since the
+   * previous values then straddle a discontinuity of the solution's derivatives.
+   * The derivative implied by the formula at the end of each step is recorded with the step
+   * as dense output.
+   */
+  template <class Differential>
+  class BDF : public frantic::Integrator<Differential>
+  {
+  private:
+    using XVector = typename Differential::XVector;
+
+  public:
+
+    using frantic::Integrator<Differential>::Integrator;  // Allow parent class overloads
+    BDF<Differential>() : frantic::Integrator<Differential>() {
+      this->order = 5;
+    }
+    virtual ~BDF() {}
+
+    void set_tolerances(double absolute, double relative) {
+      assert(absolute >= 0 and relative >= 0 and absolute + relative > 0);
+      abs_tol = absolute;
+      rel_tol = relative;
+    }
+    /* See frantic::StepControl */
+    void set_step_limits(double min, double max) { step_control.set_limits(min, max); }
+    void set_max_order(int order) {
+      assert(order >= 1 and order <= 5);
+      max_order = order;
+    }
+    /* Recompute the Jacobian at least every 'nsteps' accepted steps */
+    void set_jacobian_age(size_t nsteps) {
+      assert(nsteps > 0);
+      jacobian_age = nsteps;
+    }
+    size_t get_naccepted() const { return naccepted; }
+    size_t get_nrejected() const { return nrejected; }
+    int get_current_order() const { return k; }
+    const frantic::Linearization<Differential>& get_linearization() const { return linearization; }
+
+    void integrate(const Differential& dX);
+
+  protected:
+    double abs_tol = 1e-6;
+    double rel_tol = 1e-6;
+    frantic::StepControl step_control;
+    int max_order = 5;
+    size_t jacobian_age = 20;
+    int max_iterations = 4;      // Newton iterations per step
+    size_t naccepted = 0;
+    size_t nrejected = 0;
+
+    frantic::Linearization<Differential> linearization;
+    int k = 1;                   // Current order
+    std::deque<XVector, Eigen::aligned_allocator<XVector> > values;   // Previous values, equally spaced, most recent last
+    double spacing = 0;          // Of 'values'
+
+    /* y_{n+1} - h*beta[k] f(t_{n+1}, y_{n+1}) = sum_j alpha[k][j] y_{n-j} */
+    static constexpr double beta[6] = {0.0, 1.0, 2.0/3.0, 6.0/11.0, 12.0/25.0, 60.0/137.0};
+    static constexpr double alpha[6][5] = {
+      {0.0, 0.0, 0.0, 0.0, 0.0},
+      {1.0, 0.0, 0.0, 0.0, 0.0},
+      {4.0/3.0, -1.0/3.0, 0.0, 0.0, 0.0},
+      {18.0/11.0, -9.0/11.0, 2.0/11.0, 0.0, 0.0},
+      {48.0/25.0, -36.0/25.0, 16.0/25.0, -3.0/25.0, 0.0},
+      {300.0/137.0, -300.0/137.0, 200.0/137.0, -75.0/137.0, 12.0/137.0}};
+
+    static double binomial(int n, int j) {
+      double c = 1;
+      for (int i=1; i <= j; ++i) c = c * (n - j + i) / i;
+      return c;
+    }
+    double error_norm(const XVector& err, const XVector& x, const XVector& xout) const {
+      return (err.array().abs() / (abs_tol + rel_tol * x.array().abs().max(xout.array().abs()))).maxCoeff();
+    }
+    /* m-th backward difference of the last m+1 values */
+    XVector backward_difference(int m) const {
+      const size_t n = values.size() - 1;
+      XVector d = values[n];
+      for (int j=1; j <= m; ++j) d += ((j % 2) ? -1.0 : 1.0) * binomial(m, j) * values[n - j];
+      return d;
+    }
+    void rescale(double h);
+    bool solve(const Differential& dX, double t, double h, const XVector& predicted, const XVector& rhs,
+               XVector& x);
+  };
+
+  /* Replace the previous values by the interpolating polynomial (of degree at most k) at
+   * the spacing h, ending at the same point */
+  template <class Differential>
+  void BDF<Differential>::rescale(double h) {
+    const int npoints = std::min<int>(values.size(), k + 1);
+    const double ratio = h / spacing;
+    const size_t n = values.size() - 1;
+    std::deque<XVector, Eigen::aligned_allocator<XVector> > rescaled;
+    for (int j=npoints-1; j >= 0; --j) {
+      // Lagrange interpolation at -j*ratio, the nodes being at -i (i < npoints), in units of the old spacing
+      const double s = -j * ratio;
+      XVector v = XVector::Zero(values[n].size());
+      for (int i=0; i < npoints; ++i) {
+        double w = 1;
+        for (int l=0; l < npoints; ++l) {
+          if (l != i) w *= (s + l) / (l - i);
+        }
+        v += w * values[n - i];
+      }
+      rescaled.push_back(v);
+    }
+    rescaled.back() = values[n];   // Exactly
+    values.swap(rescaled);
+    spacing = h;
+  }
+
+  /* Simplified Newton iteration for x - h*beta*f(t, x) = rhs, starting from 'predicted'.
+   * Returns false if it doesn't converge within max_iterations. */
+  template <class Differential>
+  bool BDF<Differential>::solve(const Differential& dX, double t, double h, const XVector& predicted,
+                                const XVector& rhs, XVector& x) {
+    const double gamma = h * beta[k];
+    linearization.factorize(gamma);
+    x = predicted;
+    double previous = std::numeric_limits<double>::infinity();
+    for (int iteration=0; iteration < max_iterations; ++iteration) {
+      XVector delta = linearization.solve(rhs + gamma * dX.drift(t, x, this->history) - x);
+      x += delta;
+      double norm = error_norm(delta, predicted, x);
+      if (norm <= 1e-3) return true;
+      if (iteration > 0) {
+        double rate = norm / previous;
+        if (rate >= 0.9) return false;                 // Diverging, or too slow
+        if (rate / (1 - rate) * norm <= 0.1) return true;
+      }
+      previous = norm;
+    }
+    return false;
+  }
+
+  template <class Differential>
+  void BDF<Differential>::integrate(const Differential& dX) {
+    auto& history = this->history;
+
+    assert(history.check_initialized());
+    assert(history.t0 < history.tn);   // Only forward integration is implemented
+
+    double t = history.t0;
+    XVector x = history(t);
+    XVector dxdt = dX.drift(t, x, history);
+    this->record_initial_slope(dxdt);
+
+    const double h_limit = std::min(step_control.hmax, history.get_min_delay());
+    double h = std::min(std::abs(history.dt), h_limit);
+    naccepted = 0;
+    nrejected = 0;
+    linearization.reset();
+    linearization.update_jacobian(dX, t, x, dxdt, history);
+    size_t steps_since_jacobian = 0;
+    bool fresh_jacobian = true;         // Computed at the current (t, x)
+    k = 1;
+    values.assign(1, x);
+    spacing = h;
+    int steps_unchanged = 0;            // Since the last change of step or order
+    int nfailures = 0;                  // Consecutive rejected steps
+
+    XVector predicted, rhs, xout;
+    while (t < history.tn) {
+      const double h_try = step_control.truncate(history, t, h);
+      step_control.check_min("BDF", t, h);
+      if (h_try != spacing) {
+        rescale(h_try);
+        steps_unchanged = 0;
+      }
+
+      const size_t n = values.size() - 1;
+      if (values.size() > size_t(k)) {
+        // Extrapolation of the last k+1 values: y_{n+1} - predicted is the (k+1)-th backward difference
+        predicted = XVector::Zero(x.size());
+        for (int j=0; j <= k; ++j) predicted += ((j % 2) ? -1.0 : 1.0) * binomial(k + 1, j + 1) * values[n - j];
+      } else {
+        predicted = x + h_try * dxdt;   // Start (k = 1, single value): explicit Euler
+      }
+      rhs = XVector::Zero(x.size());
+      for (int j=0; j < k; ++j) rhs += alpha[k][j] * values[n - j];
+
+      if (!solve(dX, t + h_try, h_try, predicted, rhs, xout)) {
+        ++nrejected;
+        if (!fresh_jacobian) {
+          linearization.update_jacobian(dX, t, x, dX.drift(t, x, history), history);
+          steps_since_jacobian = 0;
+          fresh_jacobian = true;
+        } else {
+          h = h_try / 4;
+        }
+        continue;
+      }
+
+      const double err = error_norm((xout - predicted) / (k + 1), x, xout);
+      if (!(err <= 1)) {
+        ++nrejected;
+        if (++nfailures >= 2 and k > 1) --k;
+        h = std::max(0.2, 0.9 * std::pow(err, -1.0 / (k + 1))) * h_try;
+        continue;
+      }
+
+      // Accept the step
+      nfailures = 0;
+      t = step_control.end(t);
+      dxdt = (xout - rhs) / (h_try * beta[k]);
+      x = xout;
+      this->record_step(t, x, dxdt);
+      ++naccepted;
+      ++steps_unchanged;
+      values.push_back(x);
+      while (values.size() > size_t(max_order) + 2) values.pop_front();
+      fresh_jacobian = false;
+      if (++steps_since_jacobian >= jacobian_age) {
+        linearization.update_jacobian(dX, t, x, dX.drift(t, x, history), history);
+        steps_since_jacobian = 0;
+        fresh_jacobian = true;
+      }
+
+      if (step_control.is_truncated() and t < history.tn) {
+        // Restart after the critical point, from the derivative on its right
+        dxdt = dX.drift(t, x, history);
+        values.assign(1, x);
+        k = 1;
+        steps_unchanged = 0;
+        continue;
+      }
+
+      if (step_control.is_truncated() or steps_unchanged < k + 1) continue;
+      // Step size allowed by the current order and its neighbours, relative to the current one
+      int best = k;
+      double best_factor = std::pow(std::max(err, 1e-10), -1.0 / (k + 1));
+      if (k > 1) {
+        double e = error_norm(backward_difference(k) / k, x, x);
+        double factor = 0.9 * std::pow(std::max(e, 1e-10), -1.0 / k);
+        if (factor > best_factor) { best = k - 1; best_factor = factor; }
+      }
+      if (k < max_order and values.size() >= size_t(k) + 3) {
+        double e = error_norm(backward_difference(k + 2) / (k + 2), x, x);
+        double factor = 0.9 * std::pow(std::max(e, 1e-10), -1.0 / (k + 2));
+        if (factor > best_factor) { best = k + 1; best_factor = factor; }
+      }
+      best_factor = std::min(2.0, 0.9 * best_factor);
+      if (best != k or best_factor > 1.2) {
+        k = best;
+        h = std::min(h_limit, std::max(1.0, best_factor) * h_try);
+        steps_unchanged = 0;
+      }
+    }
+  }
+}
+
+#endif // BDF_H
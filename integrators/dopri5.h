@@ -0,0 +1,227 @@
+#ifndef DOPRI5_H
+#define DOPRI5_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include "integrator.h"
+
+using std::vector;
+
+namespace integrators {
+
+
+  /* Dormand-Prince 5(4) embedded Runge-Kutta integrator (5th order integration, error
+   * estimated from the embedded 4th order solution) with adaptive step size, for delayed
+   * (or ordinary) differential equations. Coefficients are those of Hairer, Norsett & Wanner,
+   * "Solving Ordinary Differential Equations I" (DOPRI5).
+   * Same interface as RKF45_gsl (and Euler_sttic), with the derivative given by
+   * dX.drift(t, x, history) and the history an InterpolatedSeries.
+   *
+   * The last stage is the derivative at the end of the step, which is the first stage of the
+   * next one (first same as last): a step costs 6 evaluations of the drift.
+   * The method has a 4th order continuous extension, i.e. the Hermite interpolant over the step
+   * plus a quartic term computed from the stages. That term is recorded with each step (see
+   * InterpolatedSeries::update(t, x, dxdt, dense_term)), so that delayed lookups between rows
+   * are as accurate as the integration itself. Histories without dense output only get the rows.
+   *
+   * Step control, critical points and steps longer than the shortest delay are handled as in
+   * RKF45_gsl: a step is accepted if the estimated error of each component is below
+   * abs_tol + rel_tol * |x|; steps end exactly on the critical points of the history and on tn;
+   * steps longer than a delay are iterated on a provisional row carrying the continuous
+   * extension, and their error also includes the defect of that extension.
+   */
+  template <class Differential>
+  class DOPRI5 : public frantic::Integrator<Differential>
+  {
+  private:
+    using XVector = typename Differential::XVector;
+
+  public:
+
+    using frantic::Integrator<Differential>::Integrator;  // Allow parent class overloads
+    DOPRI5<Differential>() : frantic::Integrator<Differential>() {
+      this->order = 5;
+    }
+    virtual ~DOPRI5() {}
+
+    void set_tolerances(double absolute, double relative) {
+      assert(absolute >= 0 and relative >= 0 and absolute + relative > 0);
+      abs_tol = absolute;
+      rel_tol = relative;
+    }
+    /* See frantic::StepControl */
+    void set_step_limits(double min, double max) { step_control.set_limits(min, max); }
+    size_t get_naccepted() const { return naccepted; }
+    size_t get_nrejected() const { return nrejected; }
+
+    void integrate(const Differential& dX);
+
+  protected:
+    double abs_tol = 1e-6;
+    double rel_tol = 1e-6;
+    frantic::StepControl step_control;
+    int max_iterations = 8;      // Iterations on the provisional row, for steps longer than a delay
+    size_t naccepted = 0;
+    size_t nrejected = 0;
+
+    /// \name Storage for the intermediate steps
+    //@{
+    XVector k2, k3, k4, k5, k6;
+    XVector xtmp;
+    //@}
+
+    /// \name Coefficients
+    //@{
+    static constexpr double c[7] = {0.0, 1.0/5.0, 3.0/10.0, 4.0/5.0, 8.0/9.0, 1.0, 1.0};
+    static constexpr double a2[1] = {1.0/5.0};
+    static constexpr double a3[2] = {3.0/40.0, 9.0/40.0};
+    static constexpr double a4[3] = {44.0/45.0, -56.0/15.0, 32.0/9.0};
+    static constexpr double a5[4] = {19372.0/6561.0, -25360.0/2187.0, 64448.0/6561.0, -212.0/729.0};
+    static constexpr double a6[5] = {9017.0/3168.0, -355.0/33.0, 46732.0/5247.0, 49.0/176.0, -5103.0/18656.0};
+    static constexpr double b[7] = {35.0/384.0, 0.0, 500.0/1113.0, 125.0/192.0, -2187.0/6784.0, 11.0/84.0, 0.0};
+    // Difference between the 5th and 4th order solutions
+    static constexpr double e[7] = {71.0/57600.0, 0.0, -71.0/16695.0, 71.0/1920.0, -17253.0/339200.0,
+                                    22.0/525.0, -1.0/40.0};
+    // Quartic term of the continuous extension
+    static constexpr double d[7] = {-12715105075.0/11282082432.0, 0.0, 87487479700.0/32700410799.0,
+                                    -10690763975.0/1880347072.0, 701980252875.0/199316789632.0,
+                                    -1453857185.0/822651844.0, 69997945.0/29380423.0};
+    //@}
+
+    double attempt(const Differential& dX, double t, double h, const XVector& x, const XVector& dxdt,
+                   XVector& xout, XVector& dxdt_out, XVector& dense_term);
+    double error_norm(const XVector& err, const XVector& x, const XVector& xout) const {
+      return (err.array().abs() / (abs_tol + rel_tol * x.array().abs().max(xout.array().abs()))).maxCoeff();
+    }
+
+    /* Given the state \c x and its derivative \c dxdt at t, take a step of size \c h giving the
+     * result in \c xout, the error estimate in \c xerr, the derivative at the end of the step
+     * (last stage) in \c dxdt_out and the quartic term of the continuous extension in \c dense_term.
+     */
+    void step(const Differential& dX, double t, double h, const XVector& x, const XVector& dxdt,
+              XVector& xout, XVector& xerr, XVector& dxdt_out, XVector& dense_term) {
+      auto& history = this->history;
+
+      xtmp = x + h * a2[0] * dxdt;
+      k2 = dX.drift(t + c[1]*h, xtmp, history);
+      xtmp = x + h * (a3[0] * dxdt + a3[1] * k2);
+      k3 = dX.drift(t + c[2]*h, xtmp, history);
+      xtmp = x + h * (a4[0] * dxdt + a4[1] * k2 + a4[2] * k3);
+      k4 = dX.drift(t + c[3]*h, xtmp, history);
+      xtmp = x + h * (a5[0] * dxdt + a5[1] * k2 + a5[2] * k3 + a5[3] * k4);
+      k5 = dX.drift(t + c[4]*h, xtmp, history);
+      xtmp = x + h * (a6[0] * dxdt + a6[1] * k2 + a6[2] * k3 + a6[3] * k4 + a6[4] * k5);
+      k6 = dX.drift(t + c[5]*h, xtmp, history);
+      xout = x + h * (b[0] * dxdt + b[2] * k3 + b[3] * k4 + b[4] * k5 + b[5] * k6);
+
+      // Last stage, i.e. first stage of the next step
+      dxdt_out = dX.drift(t + h, xout, history);
+
+      xerr = h * (e[0] * dxdt + e[2] * k3 + e[3] * k4 + e[4] * k5 + e[5] * k6 + e[6] * dxdt_out);
+      dense_term = h * (d[0] * dxdt + d[2] * k3 + d[3] * k4 + d[4] * k5 + d[5] * k6 + d[6] * dxdt_out);
+    }
+
+    /* Continuous extension at t + theta * h, and its derivative */
+    static void extension(double theta, double h, const XVector& x0, const XVector& x1, const XVector& dxdt0,
+                          const XVector& dxdt1, const XVector& dense_term, XVector& x, XVector& dxdt) {
+      double r = 1 - theta;
+      x = (r*r*(1 + 2*theta)) * x0 + (theta*theta*(3 - 2*theta)) * x1
+          + (h*theta*r*r) * dxdt0 - (h*theta*theta*r) * dxdt1 + (theta*theta*r*r) * dense_term;
+      dxdt = (6*theta*r/h) * (x1 - x0) + (r*(1 - 3*theta)) * dxdt0 - (theta*(2 - 3*theta)) * dxdt1
+             + (2*theta*r*(1 - 2*theta)/h) * dense_term;
+    }
+
+  };
+
+  /* Compute a step of length h from (t, x), returning the scaled error estimate
+   * (error_norm: accept if <= 1), or infinity if the iteration on the provisional row
+   * did not converge.
+   */
+  template <class Differential>
+  double DOPRI5<Differential>::attempt(const Differential& dX, double t, double h, const XVector& x, const XVector& dxdt,
+                                       XVector& xout, XVector& dxdt_out, XVector& dense_term) {
+    auto& history = this->history;
+    XVector xerr;
+
+    if (h <= history.get_min_delay()) {
+      // All the lookups are before t
+      step(dX, t, h, x, dxdt, xout, xerr, dxdt_out, dense_term);
+      return error_norm(xerr, x, xout);
+    }
+
+    const size_t nlines = history.get_nlines();
+    XVector guess = x + h * dxdt;     // Euler estimate of the end of the step
+    XVector guess_dxdt = dxdt;
+    XVector guess_term = XVector::Zero(x.size());
+    for (int iteration=0; iteration < max_iterations; ++iteration) {
+      history.add_provisional_row(t + h, guess, guess_dxdt, guess_term);
+      step(dX, t, h, x, dxdt, xout, xerr, dxdt_out, dense_term);
+      history.rollback(nlines);
+      double change = error_norm(xout - guess, x, xout);
+      guess = xout;
+      guess_dxdt = dxdt_out;
+      guess_term = dense_term;
+      if (change <= 0.1) {   // Converged to well within the tolerance
+        // Lookups within the step were made on the continuous extension of the previous
+        // iteration, whose error the embedded estimate doesn't include: bound it with the
+        // defect of the extension (how far it is from solving the equation) within the step.
+        history.add_provisional_row(t + h, xout, dxdt_out, dense_term);
+        double defect_err = 0;
+        XVector xq, dxdt_q;
+        for (double theta : {0.25, 0.75}) {
+          extension(theta, h, x, xout, dxdt, dxdt_out, dense_term, xq, dxdt_q);
+          defect_err = std::max(defect_err,
+                                error_norm(h * (dX.drift(t + theta * h, xq, history) - dxdt_q), x, xout));
+        }
+        history.rollback(nlines);
+        return std::max(error_norm(xerr, x, xout), defect_err);
+      }
+    }
+    return std::numeric_limits<double>::infinity();
+  }
+
+  template <class Differential>
+  void DOPRI5<Differential>::integrate(const Differential& dX) {
+    auto& history = this->history;
+
+    assert(history.check_initialized());
+    assert(history.t0 < history.tn);   // Only forward integration is implemented
+
+    double t = history.t0;
+    XVector x = history(t);
+    XVector dxdt = dX.drift(t, x, history);
+    this->record_initial_slope(dxdt);
+
+    XVector xout, dxdt_out, dense_term;
+    double h = std::min(std::abs(history.dt), step_control.hmax);
+    naccepted = 0;
+    nrejected = 0;
+
+    while (t < history.tn) {
+      const double h_try = step_control.truncate(history, t, h);
+      step_control.check_min("DOPRI5", t, h);
+
+      double err = attempt(dX, t, h_try, x, dxdt, xout, dxdt_out, dense_term);
+      if (err <= 1) {
+        t = step_control.end(t);
+        x = xout;
+        dxdt = dxdt_out;                    // First same as last
+        this->record_step(t, x, dxdt, dense_term);
+        ++naccepted;
+        double factor = (err == 0) ? 5 : std::min(5.0, std::max(0.2, 0.9 * std::pow(err, -0.2)));
+        double h_next = step_control.is_truncated() ? std::max(h, factor * h_try) : factor * h_try;
+        h = std::min(step_control.hmax, h_next);
+      } else {
+        ++nrejected;
+        double factor = std::isinf(err) ? 0.5 : std::max(0.2, 0.9 * std::pow(err, -0.2));
+        h = factor * h_try;
+      }
+    }
+  }
+}
+
+#endif // DOPRI5_H
@@ -6,7 +6,11 @@
 #include <string>
 #include <fstream>
 #include <array>
+#include <limits>
 #include <vector>
+#include <stdexcept>
+
+#include <eigen3/Eigen/Dense>
 
 #include "io.h"
 #include "o2scl/hist.h"
@@ -42,9 +46,30 @@ namespace frantic {
 
     void dump_to_text(const std::string& directory, const std::string& filename,
                       bool include_labels = true,
-                      const std::string& format = ", ", int max_files = 100);
+                      const std::string& format = ", ", int max_files = 100, unsigned nthreads = 1,
+                      int precision = 0);
+
+    /* Binary format (see BinaryHeader in io.h). Histograms extended by outliers keep their bins.
+     * The simulation range is not known to the collection, so it is passed by the caller.
+     * read_from_binary replaces the current histograms and returns the file header
+     * (header.kind is NONE if the file could not be opened).
+     */
+    void dump_to_binary(const std::string& directory, const std::string& filename, int max_files = 100,
+                        double t0 = 0, double dt = 0, double nSteps = 0);
+    BinaryHeader read_from_binary(const std::string& directory, const std::string& filename);
 
     void update(double t, const XVector& x, double val=1.0);
+    /* Add each column of 'xs' at time t, e.g. the members of an ensemble (see frantic::Ensemble) */
+    template <typename Derived>
+    void update_columns(double t, const Eigen::MatrixBase<Derived>& xs, double val=1.0) {
+      for (Eigen::Index j=0; j < xs.cols(); ++j) {
+        update(t, xs.col(j), val);
+      }
+    }
+    /* Add the counts of 'other' to this collection, e.g. to combine the collections filled
+     * by separate threads (see frantic::MonteCarlo). Snapshots at the same time (within the
+     * tolerance of find_t_idx) are summed, others are inserted at their time. */
+    void merge(const HistCollection<XVector>& other);
     void set_binning(std::function<std::array<double, 2>(double, size_t)> bin_limit_function, int nbins, BinningMode mode=UNIFORM);
     void reserve(size_t n);
     void reset();
@@ -52,8 +77,9 @@ namespace frantic {
   private:
     std::vector<double> tValues;
     std::vector<XState> xValues;
+    size_t last_t_idx = 0;   // Index returned by the last find_t_idx; searches start from there
     BinningMode binningMode;
-    int nbins;   // Number of bins in each histogram
+    int nbins;   // Number of bins of new histograms (outliers may add bins to a histogram)
     std::function<std::array<double, 2>(double, size_t)> get_bin_limits;
     // User-specified function which, given a time, returns the lower and upper limits
     // for the histogram corresponding to the specified component
@@ -61,6 +87,7 @@ namespace frantic {
     std::array<std::string, 3> getFormatStrings(std::string format);
     size_t find_t_idx(double t, double tol=1e-9);
     void set_bin_edges(o2scl::hist& hist, double t, size_t c);
+    static void add_weights(o2scl::hist& hist, const o2scl::hist& other);
   };
 
 #include "histcollection.tpp"
@@ -17,6 +17,77 @@ template <typename XVector> void HistCollection<XVector>::reset()
 {
   tValues.clear();
   xValues.clear();
+  last_t_idx = 0;
+}
+
+template <typename XVector>
+void HistCollection<XVector>::merge(const HistCollection<XVector>& other)
+{
+  const double tol = 1e-9;   // Same as find_t_idx
+  if (!get_bin_limits) {
+    get_bin_limits = other.get_bin_limits;
+    binningMode = other.binningMode;
+    nbins = other.nbins;
+  }
+  if (other.tValues.size() == 0) {
+    return;
+  }
+
+  // Both series of times are ordered: merge them
+  std::vector<double> mergedT;
+  std::vector<XState> mergedX;
+  mergedT.reserve(tValues.size() + other.tValues.size());
+  mergedX.reserve(tValues.size() + other.tValues.size());
+  size_t i = 0, j = 0;
+  while (i < tValues.size() or j < other.tValues.size()) {
+    if (j == other.tValues.size()
+        or (i < tValues.size() and tValues[i] < other.tValues[j] - tol)) {
+      mergedT.push_back(tValues[i]);
+      mergedX.push_back(std::move(xValues[i]));
+      ++i;
+    } else if (i == tValues.size() or other.tValues[j] < tValues[i] - tol) {
+      mergedT.push_back(other.tValues[j]);
+      mergedX.push_back(other.xValues[j]);
+      ++j;
+    } else {
+      mergedT.push_back(tValues[i]);
+      mergedX.push_back(std::move(xValues[i]));
+      for (size_t c=0; c < XVector::SizeAtCompileTime; ++c) {
+        add_weights(mergedX.back()[c], other.xValues[j][c]);
+      }
+      ++i;
+      ++j;
+    }
+  }
+  tValues.swap(mergedT);
+  xValues.swap(mergedX);
+  last_t_idx = 0;
+}
+
+/* Add the weights of 'other' to 'hist'. If their bins differ (e.g. one of them was extended
+   * to catch an outlier), each weight of 'other' goes to the bin of 'hist' containing the
+   * center of its bin, extending 'hist' if needed.
+   */
+template <typename XVector>
+void HistCollection<XVector>::add_weights(o2scl::hist& hist, const o2scl::hist& other)
+{
+  bool same_bins = (hist.size() == other.size());
+  for (size_t k=0; same_bins and k < hist.size(); ++k) {
+    same_bins = (hist.get_bin_low_i(k) == other.get_bin_low_i(k)
+                 and hist.get_bin_high_i(k) == other.get_bin_high_i(k));
+  }
+
+  if (same_bins) {
+    for (size_t k=0; k < hist.size(); ++k) {
+      hist.set_wgt_i(k, hist.get_wgt_i(k) + other.get_wgt_i(k));
+    }
+  } else {
+    for (size_t k=0; k < other.size(); ++k) {
+      if (other.get_wgt_i(k) != 0) {
+        hist.update(0.5 * (other.get_bin_low_i(k) + other.get_bin_high_i(k)), other.get_wgt_i(k));
+      }
+    }
+  }
 }
 
 /* Set requirements to determine binning of the histograms
@@ -80,8 +151,6 @@ template <typename XVector> void HistCollection<XVector>::update(double t, const
    */
 template <typename XVector> size_t HistCollection<XVector>::find_t_idx(double t, double tol) {
   // Start searching from the last index, since we are most likely to go forward in time
-  static size_t last_t_idx = 0;
-
   assert(tValues.size() < (size_t) - 2);  // If tValues has as many entries as it can take,
   //a) anything more will make it burst and b) the return value format becomes ambiguous
 
@@ -125,7 +194,8 @@ void HistCollection<XVector>::set_bin_edges(o2scl::hist& hist, double t, size_t
   }
 }
 
-/* Dump the collection of histograms to a text file
+/* Dump the collection of histograms to a text file, numbers with 'precision' significant
+   * digits (see io.h)
    * \todo: add determination of extension according to format
    * \todo: allow to specify what labels to include by flags; e.g. per row or per block bin edges
    */
@@ -133,7 +203,8 @@ template <typename XVector>
 void HistCollection<XVector>::dump_to_text(const std::string& directory,
                                            const std::string& filename,
                                            bool include_labels,
-                                           const std::string& format, int max_files) {
+                                           const std::string& format, int max_files, unsigned nthreads,
+                                           int precision) {
   std::string outfilename = frantic::get_free_filename(directory, filename, max_files);  // Returns "" if unsuccessful
 
   if (outfilename != "") {
@@ -160,52 +231,163 @@ void HistCollection<XVector>::dump_to_text(const std::string& directory,
     outfile << "# Row info lines: " << (include_labels ? 1 : 0) << std::endl;
     outfile << "# Info columns: " << 0 << std::endl;
 
+    // Snapshots are formatted in blocks (in parallel if nthreads != 1); numbers as described in io.h
+    const size_t snapshots_per_block = 256;
+    size_t nblocks = (tValues.size() + snapshots_per_block - 1) / snapshots_per_block;
     for (size_t c=0; c < XVector::SizeAtCompileTime; ++c) {             // c: "component"
       if (include_labels) {outfile << std::endl << "# Component: " << c << std::endl;}
 
-      for(size_t t_idx=0; t_idx < tValues.size(); ++t_idx) {
+      write_blocks(outfile, nblocks, [&](size_t block, std::string& buffer) {
+          size_t t_end = std::min(tValues.size(), (block + 1) * snapshots_per_block);
+          for(size_t t_idx=block * snapshots_per_block; t_idx < t_end; ++t_idx) {
+            const o2scl::hist& hist = xValues[t_idx][c];
+
+            if (include_labels) {
+              buffer += "# t: ";
+              append_number(buffer, tValues[t_idx], precision);
+              buffer += '\n';
+              buffer += headChar;
+              for (size_t i=0; i < hist.size(); ++i) {
+                append_number(buffer, hist.get_bin_low_i(i), precision);
+                buffer += sepChar;
+              }
+              append_number(buffer, hist.get_bin_high_i(hist.size() - 1), precision);
+              buffer += tailChar;
+              buffer += '\n';
+            }
 
-        if (include_labels) {
-          outfile << "# t: " << tValues[t_idx] << std::endl;
-          outfile << headChar;
-          for (size_t i=0; i < xValues[t_idx][c].size(); ++i) {
-            outfile << xValues[t_idx][c].get_bin_low_i(i) << sepChar;
+            buffer += headChar;
+            for(size_t i=0; i < hist.size() - 1; ++i) {
+              append_number(buffer, hist.get_wgt_i(i), precision);
+              buffer += sepChar;
+            }
+            append_number(buffer, hist.get_wgt_i(hist.size() - 1), precision);  // Don't put a sep character for last column
+            buffer += tailChar;
+            buffer += '\n';
           }
-          outfile << xValues[t_idx][c].get_bin_high_i(xValues[t_idx][c].size() - 1) << tailChar;
-          outfile << std::endl;
-        }
+        }, nthreads);
+    }
 
-        outfile << headChar;
+    outfile.close();
 
-        for(size_t i=0; i < xValues[t_idx][c].size() - 1; ++i) {
-          outfile << xValues[t_idx][c].get_wgt_i(i) << sepChar;
-        }
-        outfile << xValues[t_idx][c].get_wgt_i(xValues[t_idx][c].size() - 1) << tailChar;  // Don't put a sep character for last column
-        outfile << std::endl;
+    std::cout << "Histogram snapshots written to \n" + outfilename + "\n";
+  } else {
+    std::cerr << "Unable to open a file to export histogram snapshots data" << std::endl;
+  }
+}
+
+template <typename XVector>
+void HistCollection<XVector>::dump_to_binary(const std::string& directory, const std::string& filename,
+                                             int max_files, double t0, double dt, double nSteps) {
+  std::string outfilename = frantic::get_free_filename(directory, filename, max_files);  // Returns "" if unsuccessful
+
+  if (outfilename != "") {
+    std::ofstream outfile(outfilename.c_str(), std::ios::out | std::ios::binary);
+
+    BinaryHeader header;
+    header.kind = BinaryHeader::HISTOGRAMS;
+    header.ncomponents = XVector::SizeAtCompileTime;
+    header.nrows = tValues.size();
+    // Histograms which took in outliers have more bins: records are sized for the largest
+    header.nbins = (tValues.size() > 0) ? 0 : nbins;
+    for (const XState& state : xValues) {
+      for (const o2scl::hist& hist : state) {
+        header.nbins = std::max<uint64_t>(header.nbins, hist.size());
       }
+    }
+    header.t0 = t0;
+    header.dt = dt;
+    header.nSteps = nSteps;
+    header.write(outfile);
 
-      outfile.close();
+    outfile.write(reinterpret_cast<const char*>(tValues.data()), tValues.size() * sizeof(double));
 
-      std::cout << "Histogram snapshots written to \n" + outfilename + "\n";
+    std::vector<double> buffer;
+    buffer.reserve(std::max<size_t>(header.nbins + 1, tValues.size()));
+    for (size_t c=0; c < XVector::SizeAtCompileTime; ++c) {
+      buffer.clear();
+      for(size_t t_idx=0; t_idx < tValues.size(); ++t_idx) {
+        buffer.push_back(xValues[t_idx][c].size());
+      }
+      outfile.write(reinterpret_cast<const char*>(buffer.data()), buffer.size() * sizeof(double));
+      for(size_t t_idx=0; t_idx < tValues.size(); ++t_idx) {
+        const o2scl::hist& hist = xValues[t_idx][c];
+        buffer.assign(header.nbins + 1, std::numeric_limits<double>::quiet_NaN());
+        for (size_t i=0; i < hist.size(); ++i) {
+          buffer[i] = hist.get_bin_low_i(i);
+        }
+        buffer[hist.size()] = hist.get_bin_high_i(hist.size() - 1);
+        outfile.write(reinterpret_cast<const char*>(buffer.data()), buffer.size() * sizeof(double));
+      }
+      for(size_t t_idx=0; t_idx < tValues.size(); ++t_idx) {
+        const o2scl::hist& hist = xValues[t_idx][c];
+        buffer.assign(header.nbins, 0.0);
+        for (size_t i=0; i < hist.size(); ++i) {
+          buffer[i] = hist.get_wgt_i(i);
+        }
+        outfile.write(reinterpret_cast<const char*>(buffer.data()), buffer.size() * sizeof(double));
+      }
     }
+
+    outfile.close();
+
+    std::cout << "Histogram snapshots written to \n" + outfilename + "\n";
   } else {
     std::cerr << "Unable to open a file to export histogram snapshots data" << std::endl;
   }
 }
 
 template <typename XVector>
-std::array<std::string, 3> HistCollection<XVector>::getFormatStrings(std::string format) {
-  std::array<std::string, 3> formatStrings;
+BinaryHeader HistCollection<XVector>::read_from_binary(const std::string& directory, const std::string& filename) {
+  std::string infilename = directory + "/" + filename;
+  MappedFile file(infilename);
 
-  if (format == "org") {
-    formatStrings[0] = "|";
-    formatStrings[1] = " |";
-    formatStrings[2] = "|";
-  } else {
-    formatStrings[0] = "";
-    formatStrings[1] = format;
-    formatStrings[2] = "";
+  if (!file.is_open()) {
+    std::cerr << "Couldn't find file " << infilename << "." << std::endl;
+    return BinaryHeader();
+  }
+
+  BinaryHeader header = BinaryHeader::read(file.data(), file.size());
+  if (header.kind != BinaryHeader::HISTOGRAMS or header.ncomponents != XVector::SizeAtCompileTime) {
+    throw std::runtime_error(infilename + " does not contain histograms with "
+                             + std::to_string(XVector::SizeAtCompileTime) + " components.");
+  }
+
+  reset();
+  size_t nrows = header.nrows;
+  size_t nb = header.nbins;
+  nbins = nb;
+  reserve(nrows);
+
+  const double* times = reinterpret_cast<const double*>(file.data() + header.data_offset);
+  tValues.assign(times, times + nrows);
+  xValues.resize(nrows);
+
+  std::vector<double> edges(nb + 1);
+  for (size_t c=0; c < XVector::SizeAtCompileTime; ++c) {
+    const double* ccounts = times + nrows + c * nrows * (2*nb + 2);
+    const double* cedges = ccounts + nrows;
+    const double* cweights = cedges + nrows * (nb + 1);
+    for(size_t t_idx=0; t_idx < nrows; ++t_idx) {
+      size_t count = static_cast<size_t>(ccounts[t_idx]);
+      if (!(ccounts[t_idx] >= 1) or count > nb) {
+        throw std::runtime_error(infilename + ": invalid number of bins for a histogram.");
+      }
+      o2scl::hist& hist = xValues[t_idx][c];
+      hist.extend_rhs = true;
+      hist.extend_lhs = true;
+      edges.assign(cedges + t_idx * (nb + 1), cedges + t_idx * (nb + 1) + count + 1);
+      hist.set_bin_edges(count + 1, edges);
+      for (size_t i=0; i < count; ++i) {
+        hist.set_wgt_i(i, cweights[t_idx * nb + i]);
+      }
+    }
   }
 
-  return formatStrings;
+  return header;
+}
+
+template <typename XVector>
+std::array<std::string, 3> HistCollection<XVector>::getFormatStrings(std::string format) {
+  return get_format_strings(format);
 }
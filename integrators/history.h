@@ -9,10 +9,22 @@
 #include <vector>
 #include <array>
 #include <set>
+#include <map>
+#include <deque>
+#include <limits>
+#include <stdexcept>
+#include <numeric>         // Required for std::accumulate
 #include <iterator>        // Required for std::next
-//#include <algorithm.h>   // Required for std::lower_bound
+#include <algorithm>       // Required for std::lower_bound
+#include <atomic>
+#include <memory>
+#include <utility>         // Required for std::integer_sequence
+#include <type_traits>
 
-#include "o2scl/table.h"
+#include "storage.h"
+#include "parallel.h"
+#include "sinks.h"
+#include "statistics.h"
 #include "histcollection.h"
 #include "io.h"
 
@@ -28,6 +40,8 @@ namespace frantic {
     double t0 = 0, tn = 0;
     double dt;
     double nSteps;
+    size_t record_stride = 1;           // Store one step out of every 'record_stride'
+    std::vector<double> record_times;   // If not empty, store only the steps nearest to these times
 
     /* Returns true if t is beyond the end time of the simulation (tn)
      * 'beyond' is defined as greater than if the simulation is going forward (t0 < tn),
@@ -56,6 +70,8 @@ namespace frantic {
         tn = 0;
         dt = 0;
         nSteps = 0;
+        record_stride = 1;
+        record_times.clear();
       }
       // Don't do anything here that shouldn't be done twice (diamond inheritance)
     }
@@ -108,6 +124,29 @@ namespace frantic {
 
     }
 
+    /* Decimated recording: the integrator still steps on the fine grid set by set_range,
+     * but only some of the steps are stored long-term.
+     * With a stride k, one step out of k is stored (the initial state counting as step 0).
+     * With a list of times, the step nearest to each time is stored (i.e. the first step
+     * no more than dt/2 before it). The initial state is always stored.
+     * Call before set_range, so that the memory reserved matches the number of stored rows.
+     * Histories which interpolate keep a short buffer of fine steps for delayed lookups.
+     */
+    void set_recording(size_t stride) {
+      assert(stride > 0);
+      record_stride = stride;
+      record_times.clear();
+    }
+    void set_recording(const std::vector<double>& times) {
+      record_stride = 1;
+      record_times = times;
+      std::sort(record_times.begin(), record_times.end());
+    }
+    /* Returns true if not every step is stored */
+    bool decimated() const {
+      return record_stride > 1 or !record_times.empty();
+    }
+
     /* Basic sanity check for initial conditions
      * Returns false if one of the initialization values is clearly improperly set
      */
@@ -136,11 +175,59 @@ namespace frantic {
 
 
 
+  /* Call f(std::integral_constant<int, 0>()), ..., f(std::integral_constant<int, N-1>()).
+   * The calls are unrolled at compile time, and inside f the index is a constant expression
+   * (decltype(i)::value), e.g. for the kernels over the 'ip' interpolation nodes.
+   */
+  template <class F, int... I>
+  inline void unroll(F&& f, std::integer_sequence<int, I...>) {
+    (f(std::integral_constant<int, I>()), ...);
+  }
+  template <int N, class F>
+  inline void unroll(F&& f) {
+    unroll(std::forward<F>(f), std::make_integer_sequence<int, (N > 0) ? N : 0>());
+  }
+
+  template <class Nodes> size_t lookup_row(const Nodes& nodes, double t);
+  template <class Nodes> size_t lookup_row(const Nodes& nodes, double t, const GridIndex& grid);
+  template <class Nodes> size_t lookup_row(const Nodes& nodes, double t, const GridIndex& grid, size_t hint);
+
+  /* The first 'nlines' rows of 'nodes', as seen by a reader while another thread appends
+   * rows (see Series::available_rows()). Provides the node interface used by lookup_row and
+   * the interpolation functions.
+   */
+  template <class Nodes>
+  struct RowsView {
+    const Nodes& nodes;
+    size_t nlines;
+
+    double time(size_t row) const { return nodes.time(row); }
+    auto row(size_t row) const { return nodes.row(row); }
+    size_t first_line() const { return nodes.first_line(); }
+    size_t get_nlines() const { return nlines; }
+  };
+
+  /* Counter shared with reader threads (e.g. the number of rows they may access). Wraps an
+   * atomic so that the containing class remains copyable.
+   */
+  struct AtomicCount {
+    std::atomic<size_t> n{0};
+
+    AtomicCount() {}
+    AtomicCount(const AtomicCount& other) : n(other.n.load()) {}
+    AtomicCount& operator=(const AtomicCount& other) { n.store(other.n.load()); return *this; }
+  };
+
   /* Specialized class for tables containing series data
    * (i.e. nD dependent vector (x) vs 1D independent variable (t))
    * An \c InitialState class gives the initial condition of the process;
    *   it must provide:
    *   - the () operator to evaluate over its domain
+   * The \c Storage template parameter selects how rows are laid out in memory (see storage.h):
+   *   - TableStorage (default): an o2scl::table, one vector per column
+   *   - ContiguousStorage: aligned, row-major buffer with Eigen::Map row and column views
+   *   - RingStorage: same layout, keeping only a window of recent rows
+   *   - MappedStorage: read-only view of a file written by dump_to_binary
    *
    * \todo: Specialize class for InitialState == XVector (for non-delayed processes)
    * \todo: Implement move semantics constructor
@@ -148,11 +235,11 @@ namespace frantic {
    * \todo: Add macro for Eigen data members ? (might still be necessary for creation with 'new'
    * \todo: Implement structure(s?) to store error
    */
-  template <typename XVector>
-  class Series : public o2scl::table<std::vector<double> >, public virtual History
+  template <typename XVector, template <typename> class Storage = TableStorage>
+  class Series : public Storage<XVector>, public virtual History
   {
   private:
-    using super = o2scl::table<std::vector<double> >;
+    using super = Storage<XVector>;
 
   public:
 
@@ -166,6 +253,7 @@ namespace frantic {
       std::vector<double> mean;//(XVector::SizeAtCompileTime);
       std::vector<double> max;//(XVector::SizeAtCompileTime);
       std::vector<double> min;//(XVector::SizeAtCompileTime);
+      std::vector<double> variance;
       long nsteps;
     };
 
@@ -179,6 +267,7 @@ namespace frantic {
 
     virtual bool check_initialized() {
       bool retval = true;
+      size_t nlines = this->get_nlines();
       if (nlines == 0) {
         std::cerr << "Call set_initial_state() before integrating : first row of series table must be pre-filled.";
         retval = false;
@@ -199,16 +288,17 @@ namespace frantic {
     void set_range(double begin, double end, T stepSize_or_numSteps, double growFactor = 1) {
       History::set_range(begin, end, stepSize_or_numSteps);
 
-      long minlines=(nSteps + 1) * growFactor; // +1 for the initial condition (which is not a step)
-      if (get_maxlines() < minlines) {
-        inc_maxlines(minlines - get_maxlines());  // inc_maxlines(n) appends n lines to the existing ones
+      double nrecorded = record_times.empty() ? std::floor(nSteps / record_stride) : record_times.size();
+      size_t minlines=(nrecorded + 1) * growFactor; // +1 for the initial condition (which is not a step)
+      if (this->get_maxlines() < minlines) {
+        this->inc_maxlines(minlines - this->get_maxlines());  // inc_maxlines(n) appends n lines to the existing ones
       }
     }
 
     /* Low-level function that allows to set the time and value of a particular row
      * The onus is on the caller to ensure that \c t is valid at this \c row.
      */
-    void set(size_t row, double t, const XVector& x);
+    void set(size_t row, double t, const XVector& x) { this->set_row(row, t, x); grid.add(row, t); publish(); }
     /* Set the values over the entire range to the result of \c function.
      * \c function should take a value of time (\c double) and return a state value (\c XVector).
      * Note: A more optimized function should probably be used within performance dependent loops.
@@ -222,10 +312,57 @@ namespace frantic {
 
     void set_initial_state(const XVector& initial_state) {
       this->initial_state = initial_state;
-      set(0, t0, initial_state); // The integrator expects the first row to be set
+      set_initial_row(initial_state); // The integrator expects the first row to be set
+    }
+    void line_of_data(double t, const XVector& x) {  // overloaded data adding function to allow using the XVector type
+      this->append_row(t, x);
+      grid.add(this->get_nlines() - 1, t);
+      publish();
+    }
+    /* Remove the rows from 'nlines' on, e.g. provisional rows of a step rejected by an adaptive
+     * integrator. Only for rows added with line_of_data or set: rows recorded by update() have
+     * already been passed to the sinks and statistics, which can't be rolled back.
+     * Rows below available_rows() must not be rolled back while other threads read them.
+     */
+    void rollback(size_t nlines) {
+      assert(nlines >= this->first_line() and nlines <= this->get_nlines());
+      this->set_nlines(nlines);
+      grid.truncate(nlines);
+      publish();
+    }
+    /* Number of rows completely written. While one thread adds rows, other threads may read
+     * the rows below this count; the storage must then not reallocate (reserve enough rows,
+     * e.g. through set_range) nor discard rows (i.e. not RingStorage).
+     */
+    size_t available_rows() const { return published.n.load(std::memory_order_acquire); }
+    /* Add the state reached by an integration step.
+     * Alias for line_of_data for the common interface, except that when recording is
+     * decimated, only the selected steps reach the table; the others only go to the fine buffer.
+     */
+    void update(double t, const XVector& x) {
+      if (this->decimated()) {
+        recent.append_row(t, x);
+        recent_grid.add(recent.get_nlines() - 1, t);
+        recorded = record_step(t);
+        if (recorded) {
+          store(t, x);
+        }
+      } else {
+        store(t, x);
+      }
+    }
+    /* Attach a sink which will receive every recorded row from now on. Rows already
+     * stored are passed to it immediately, so it sees the whole series if attached
+     * before integrating. Sinks are closed and detached by reset().
+     */
+    void add_sink(std::shared_ptr<SeriesSink<XVector> > sink);
+    void flush_sinks() {
+      for (auto& sink : sinks) {
+        sink->flush();
+      }
     }
-    void line_of_data(double t, const XVector& x);  // overloaded data adding function to allow using the XVector type
-    void update(double t, const XVector& x) { line_of_data(t, x); }  // alias for common interface. Might want to check http://stackoverflow.com/questions/3053561/how-do-i-assign-an-alias-to-a-function-name-in-c
+    /* Returns true if the last state passed to update() was stored */
+    bool last_recorded() const { return recorded; }
     
     XVector operator ()() const; // Return the current state vector
     XVector operator ()(const double t) const; // Shorthand for getVectorAtTime(t)
@@ -233,51 +370,144 @@ namespace frantic {
     XVector getVectorAtTime(const double t_idx) const;
 
     struct dump_to_text_t : public SaveHistory {
-      Series<XVector>* object;
-      dump_to_text_t(Series<XVector>* containing_object,
+      Series<XVector, Storage>* object;
+      unsigned nthreads;   // Threads used to format the numbers (0: one per core)
+      int precision;       // Significant digits (0: shortest form that reads back exactly)
+      dump_to_text_t(Series<XVector, Storage>* containing_object,
                      const std::string& name = "series", bool include_labels = true,
-                     const std::string& format = ", ", int max_files = 100) {
+                     const std::string& format = ", ", int max_files = 100, unsigned nthreads = 1,
+                     int precision = 0) {
         object = containing_object; // We need a reference to the object instance
         this->name = name;
         this->include_labels = include_labels,
         this->format = format;
         this->max_files = max_files;
+        this->nthreads = nthreads;
+        this->precision = precision;
       }
       virtual void operator() (const std::string& directory, const std::string& filename);
     };
     dump_to_text_t dump_to_text(const std::string& name = "series", bool include_labels = true,
-                                const std::string& format = ", ", int max_files = 100) {
-      return dump_to_text_t(this, name, include_labels, format, max_files);
+                                const std::string& format = ", ", int max_files = 100, unsigned nthreads = 1,
+                                int precision = 0) {
+      return dump_to_text_t(this, name, include_labels, format, max_files, nthreads, precision);
     }
 
     void read_from_text(const std::string& directory, const std::string& filename,
-                        const std::string& format = ", ");
+                        const std::string& format = ", ", unsigned nthreads = 0);
+
+    /* Binary format (see BinaryHeader in io.h): much faster to write and read than text,
+     * and about a third of the size. With MappedStorage, read_from_binary maps the file
+     * instead of copying it.
+     */
+    struct dump_to_binary_t : public SaveHistory {
+      Series<XVector, Storage>* object;
+      dump_to_binary_t(Series<XVector, Storage>* containing_object,
+                       const std::string& name = "series", int max_files = 100) {
+        object = containing_object;
+        this->name = name;
+        this->include_labels = true;   // Column names are always stored
+        this->format = "binary";
+        this->max_files = max_files;
+      }
+      virtual void operator() (const std::string& directory, const std::string& filename);
+    };
+    dump_to_binary_t dump_to_binary(const std::string& name = "series", int max_files = 100) {
+      return dump_to_binary_t(this, name, max_files);
+    }
 
+    void read_from_binary(const std::string& directory, const std::string& filename);
+
+    /* Opt-in accumulation of statistics over the recorded states, as they are added by
+     * update() (see RunningStatistics). Call before set_initial_state; statistics are then
+     * available at any time from statistics(), and getStatistics() uses them instead of
+     * scanning the stored rows. They also cover rows which are no longer in memory
+     * (RingStorage, sinks).
+     */
+    void track_statistics(bool enable=true, bool higher_moments=false) {
+      statistics_tracked = enable;
+      running_statistics.set_higher_moments(higher_moments);
+      running_statistics.reset();
+    }
+    bool statistics_enabled() const { return statistics_tracked; }
+    const RunningStatistics<XVector>& statistics() const { return running_statistics; }
     Statistics getStatistics();
     void reset(bool reset_range=false) {
-      clear_data(); // Reset all data in order to restart a new computation
+      for (auto& sink : sinks) {
+        sink->close();
+      }
+      sinks.clear();
+      this->clear_data(); // Reset all data in order to restart a new computation
+      grid.clear();
+      publish();
+      recent.clear_data();
+      recent_grid.clear();
+      running_statistics.reset();
+      nupdates = 0;
+      next_record_time = 0;
+      recorded = true;
       History::reset(reset_range);  // Also reset t0, tn if reset_range == true
     }
     
     template <typename XXVector>  // The result of the function could have a different vector type
-    Series<XXVector> eval_function(std::function<XXVector(double, XVector)> f) const {
-      Series<XXVector> result("x", get_nlines());
-      XVector cur_x;
+    Series<XXVector, Storage> eval_function(std::function<XXVector(double, XVector)> f) const {
+      Series<XXVector, Storage> result("x", this->get_nlines());
 
-      for(size_t irow=0; irow < get_nlines(); ++irow) {
-        for(size_t icol=0; icol < XVector::SizeAtCompileTime; ++icol) {
-          cur_x(icol) = get(icol + 1, irow);
-        }
-        result.line_of_data(get(0, irow), f(get(0, irow), cur_x));
+      for(size_t irow=this->first_line(); irow < this->get_nlines(); ++irow) {
+        result.line_of_data(this->time(irow), f(this->time(irow), this->row(irow)));
       }
 
       return std::move(result);
     }
 
-    double max(size_t icol); using o2scl::table<std::vector<double> >::max;
-    double min(size_t icol); using o2scl::table<std::vector<double> >::min;
+    std::vector<std::string> get_column_names() const {
+      std::vector<std::string> names;
+      for(size_t i=0; i < this->get_ncolumns(); ++i) {
+        names.push_back(this->get_column_name(i));
+      }
+      return names;
+    }
+
+    double max(size_t icol) const;
+    double max(const std::string& colname) const { return max(this->column_index(colname)); }
+    double min(size_t icol) const;
+    double min(const std::string& colname) const { return min(this->column_index(colname)); }
     
   protected:
+    RingStorage<XVector> recent;   // Fine steps, kept only when recording is decimated
+    GridIndex grid;                // Spacing of the stored rows, for O(1) lookups
+    GridIndex recent_grid;         // Same, for the fine steps
+    size_t nupdates = 0;           // Number of steps passed to update() since the initial state
+    size_t next_record_time = 0;   // Index of the next time to record in record_times
+    bool recorded = true;
+    std::vector<std::shared_ptr<SeriesSink<XVector> > > sinks;
+    bool statistics_tracked = false;
+    RunningStatistics<XVector> running_statistics;
+    AtomicCount published;
+
+    void publish() { published.n.store(this->get_nlines(), std::memory_order_release); }
+    /* Same as line_of_data, without making the row available to readers */
+    void append_unpublished(double t, const XVector& x) {
+      this->append_row(t, x);
+      grid.add(this->get_nlines() - 1, t);
+    }
+
+    void write_sinks(double t, const XVector& x) {
+      for (auto& sink : sinks) {
+        sink->write(t, x);
+      }
+    }
+    /* Record a state reached by the integration: stored row, sinks and statistics */
+    void store(double t, const XVector& x) {
+      line_of_data(t, x);
+      write_sinks(t, x);
+      if (statistics_tracked) {
+        running_statistics.update(x);
+      }
+    }
+    size_t lookup_row(double t) const;
+    void set_initial_row(const XVector& x);
+    bool record_step(double t);
     static std::array<std::string, 3> getFormatStrings(std::string format);
     XVector initial_state;  // if initial_state is defined by the value at more than one time point,
                             // one should be use InterpolatedSeries
@@ -301,6 +531,15 @@ namespace frantic {
        is optimised specifically for repeated sequential calls, as is the case
        with differential equation integrators.
 
+       Every delay passed to add_critical_point is registered; with RingStorage, only the
+       rows within the longest registered delay (plus the interpolation stencil) are kept,
+       and interpolating further back throws std::out_of_range.
+
+       Critical points (where the solution is not smooth, and interpolation nodes must not
+       straddle) are either given explicitly (add_critical_point) or generated from a
+       discontinuity and all registered delays (add_discontinuity). Integrators can use
+       next_critical_point() to stop on them, or aligned_step() to choose a step landing on them.
+
        \todo: Allow \c initial_state to have different interpolation parameters.
               Should be a template parameter with a default type
        \todo: Add special case for when critical points are too close for interpolation order
@@ -310,10 +549,10 @@ namespace frantic {
        \todo: Allow prehistory to be defined by series, not just function
        \todo: Deal with initial times different than 0 ?
        ====================================================================== */
-  template <typename XVector, int order, int ip=4>
-  class InterpolatedSeries : public Series<XVector>
+  template <typename XVector, int order, int ip=4, template <typename> class Storage = TableStorage>
+  class InterpolatedSeries : public Series<XVector, Storage>
   {
-    typedef Series<XVector> super;
+    typedef Series<XVector, Storage> super;
     
   public:
 
@@ -322,15 +561,107 @@ namespace frantic {
      * (value for r < t <= 0) should be set with set_initial_state.
      * \todo Refine assert to check that ip is sufficient for interpolation (consider schemes with different order than ip - 1) ? */
     InterpolatedSeries(std::string varname="x", size_t cmaxlines=0)
-      : Series<XVector>(varname, cmaxlines) {
+      : Series<XVector, Storage>(varname, cmaxlines) {
       assert(ip - 1 >= order);
+      this->recent.set_retention(0, ip + 1);
     }
+    /* Interpolation state over one set of rows: 'v' is the index of the last node used for
+     * interpolation, and 'coeff' the Newton coefficients computed for the nodes ending at v. */
+    struct NodeCursor {
+      size_t v = 0;                           // Avoid using v=-1 : size_t is strictly positive
+      size_t crit = 0;                        // Position in critical_points, see next_critical_index
+      size_t row = 0;                         // Row found by the last lookup, where the next one starts
+      std::array<XVector, ip> coeff;
+      std::array<double, ip> times;           // Times of the nodes v - ip + 1, ..., v
+      NodeCursor() { coeff.fill(XVector::Zero()); times.fill(0); }
+    };
+    /* Interpolation state of one reader. Coefficients are cached between calls, so lookups
+     * are fastest when successive times are close. Each thread reading the history should
+     * use its own Cursor; 'initial' is created when the initial state is first read.
+     */
+    struct Cursor {
+      NodeCursor rows;                  // Over the stored rows
+      NodeCursor fine;                  // Over the fine buffer (integrator only, see interpolate())
+      std::unique_ptr<Cursor> initial;  // Over the initial state
+      size_t generation = 0;            // Cursors from before a reset() of the series are discarded
+      size_t local_generation = 0;      // Same, for rollbacks of unpublished rows (integrator only)
+
+      Cursor() {}
+      Cursor(const Cursor& other) : rows(other.rows), fine(other.fine),
+                                    initial(other.initial ? new Cursor(*other.initial) : nullptr),
+                                    generation(other.generation), local_generation(other.local_generation) {}
+      Cursor& operator=(const Cursor& other) {
+        rows = other.rows;
+        fine = other.fine;
+        initial.reset(other.initial ? new Cursor(*other.initial) : nullptr);
+        generation = other.generation;
+        local_generation = other.local_generation;
+        return *this;
+      }
+    };
+
+    /* Lookup of the state at a constant delay, i.e. tap(t) == history(t - delay).
+     * With a fixed step, t - delay falls at the same fraction of a step between two rows at
+     * every step, so the Lagrange weights of the 'ip' interpolation nodes are computed once
+     * and each lookup is a dot product over those rows. The nodes are the same as those
+     * chosen by interpolate(). Weights are reused while the fraction stays within
+     * 'tolerance' (in steps) of the one they were computed for, and the nodes must be
+     * uniformly spaced to within the same tolerance, so results differ from interpolate()
+     * by about tolerance * step * |dx/dt| at most. A few sets of weights are kept, for
+     * lookups at several fractions (e.g. the stages of a Runge-Kutta step).
+     * The general path (with the tap's own cursor) is used instead when the nodes are not
+     * uniformly spaced, when they would straddle a critical point, for the most recent
+     * rows (not all nodes stored yet), and before t0 (initial state). It is also used when
+     * the series has dense output (see update(t, x, dxdt)), which is then preferred.
+     * Obtain taps from InterpolatedSeries::add_delay_tap; a tap refers to the series it was
+     * obtained from, which must outlive it.
+     */
+    class DelayTap
+    {
+    public:
+      XVector operator() (double t) const;
+      double delay() const { return tau; }
+
+      static constexpr double tolerance = 1e-9;
+      static constexpr int nweights = 4;    // Sets of weights kept
+
+    private:
+      friend class InterpolatedSeries;
+      DelayTap(const InterpolatedSeries* series, double delay) : series(series), tau(delay) {}
+
+      const InterpolatedSeries* series;
+      double tau;
+      mutable Cursor cursor;       // For the general path
+      mutable std::array<double, nweights> thetas = filled(std::numeric_limits<double>::quiet_NaN());  // Fractions of a step for which 'weights' were computed
+      mutable std::array<std::array<double, ip>, nweights> weights;
+      mutable int next_weights = 0;  // Set of weights replaced next
+      mutable size_t row = 0;      // Row found by the last lookup
+      mutable size_t crit = 0;     // Position in critical_points
+
+      static std::array<double, nweights> filled(double value) {
+        std::array<double, nweights> a;
+        a.fill(value);
+        return a;
+      }
+
+      template <class Nodes> bool lookup_nodes(const Nodes& nodes, const GridIndex& grid, double t, XVector& x) const;
+    };
+
     /* \todo: Implement swap / move semantics */
     InterpolatedSeries& operator=(const InterpolatedSeries& other) {
       critical_points = other.critical_points;
-      v = other.v;
-      coeff = other.coeff;
-      Series<XVector>::operator=(other);
+      std::atomic_store(&shared_critical_points, std::make_shared<const std::vector<double> >(critical_points));
+      explicit_points = other.explicit_points;
+      discontinuities = other.discontinuities;
+      delays = other.delays;
+      own_cursor = other.own_cursor;
+      slopes = other.slopes;
+      recent_slopes = other.recent_slopes;
+      dense_terms = other.dense_terms;
+      recent_dense_terms = other.recent_dense_terms;
+      lookup_cursors = other.lookup_cursors;
+      lookup_cursor_names = other.lookup_cursor_names;
+      Series<XVector, Storage>::operator=(other);
       return *this;
     }
 
@@ -343,9 +674,92 @@ namespace frantic {
      *   in the caller (i.e. an already declared lvalue we intend to reuse).
      *   Use of shared_ptr ensures that in both cases memory is properly deallocated.
      */
-    void set_initial_state(std::shared_ptr<InterpolatedSeries<XVector, order, ip> > state) {
+    void set_initial_state(std::shared_ptr<InterpolatedSeries<XVector, order, ip, Storage> > state) {
       initial_state = state;
-      super::set(0, this->t0, (*initial_state)(this->t0)); // The integrator expects the first row to be set
+      clear_dense_output();
+      this->set_initial_row((*initial_state)(this->t0)); // The integrator expects the first row to be set
+    }
+
+    /* Dense output: integrators which know the derivative at the end of each step (e.g.
+     * methods with the first-same-as-last property) pass it along with the state, and
+     * lookups between two rows which both have a derivative use the cubic Hermite
+     * interpolant over that single step instead of the 'ip' point Newton polynomial.
+     * This involves no divided differences, is unaffected by critical points between
+     * neighbouring rows and keeps its accuracy (O(dt^4)) with larger steps.
+     * The derivative of the initial row, if known, is given with set_initial_slope.
+     * Rows without a derivative (e.g. when added with update(t, x)) fall back to the
+     * Newton interpolation. Derivatives are not used by concurrent readers (operator()(t, Cursor&)).
+     * Integrators with a continuous extension of higher order (e.g. Dormand-Prince) can also
+     * give, for each step, the vector r of its quartic term: the interpolant over the step
+     * ending at this row is then the Hermite one plus s^2 (1-s)^2 r, with s the fraction of
+     * the step.
+     * Classes overriding update(t, x) should also forward these overloads (e.g. with a using declaration).
+     */
+    void update(double t, const XVector& x) { super::update(t, x); }
+    void update(double t, const XVector& x, const XVector& dxdt) {
+      super::update(t, x);
+      if (this->decimated()) {
+        recent_slopes.add(this->recent.get_nlines() - 1, dxdt);
+        recent_slopes.discard_before(this->recent.first_line());
+      }
+      if (this->last_recorded()) {
+        slopes.add(this->get_nlines() - 1, dxdt);
+        slopes.discard_before(this->first_line());
+      }
+    }
+    void update(double t, const XVector& x, const XVector& dxdt, const XVector& dense_term) {
+      update(t, x, dxdt);
+      // Only valid for the step from the previous row: with decimation, that is the fine buffer
+      if (this->decimated()) {
+        recent_dense_terms.add(this->recent.get_nlines() - 1, dense_term);
+        recent_dense_terms.discard_before(this->recent.first_line());
+      } else if (this->last_recorded()) {
+        dense_terms.add(this->get_nlines() - 1, dense_term);
+        dense_terms.discard_before(this->first_line());
+      }
+    }
+    void set_initial_slope(const XVector& dxdt) {
+      assert(this->get_nlines() == 1);   // Call after set_initial_state, before integrating
+      clear_dense_output();
+      slopes.add(0, dxdt);
+      if (this->decimated()) {
+        recent_slopes.add(this->recent.get_nlines() - 1, dxdt);
+      }
+    }
+    bool has_dense_output() const { return !slopes.empty(); }
+
+    /* Provisional rows, for integrators taking steps longer than the shortest delay, whose
+     * stages then need the solution within the step itself: an estimate of the end of the
+     * step is added with its derivative (so that lookups within the step use the Hermite
+     * interpolant), and removed with rollback() once the step is computed or rejected.
+     * Provisional rows are not passed to sinks or statistics, nor published to concurrent
+     * readers (see Series::available_rows()). Not available with decimated recording.
+     */
+    void add_provisional_row(double t, const XVector& x, const XVector& dxdt) {
+      assert(!this->decimated());
+      this->append_unpublished(t, x);
+      slopes.add(this->get_nlines() - 1, dxdt);
+    }
+    void add_provisional_row(double t, const XVector& x, const XVector& dxdt, const XVector& dense_term) {
+      add_provisional_row(t, x, dxdt);
+      dense_terms.add(this->get_nlines() - 1, dense_term);
+    }
+    void rollback(size_t nlines) {
+      // Cursors may hold coefficients computed from the removed rows. Those of concurrent
+      // readers only if the rows had been published.
+      const bool published_rows = (nlines < this->available_rows());
+      super::rollback(nlines);
+      slopes.discard_from(nlines);
+      dense_terms.discard_from(nlines);
+      ++local_generation;
+      if (published_rows) {
+        generation.n.fetch_add(1, std::memory_order_release);
+      }
+    }
+    /* Shortest registered delay (infinity if none), i.e. the longest step whose stages only
+     * look up times before the start of the step. */
+    double get_min_delay() const {
+      return delays.empty() ? std::numeric_limits<double>::infinity() : delays.front();
     }
 
     /* Return the state vector at any time in the past.
@@ -353,47 +767,188 @@ namespace frantic {
      * \todo: move to .tpp file
      */
     XVector operator () (double t) const {
-      if (t < History::t0) {
-        // Time precedes our current history ->
-        assert(initial_state != NULL);   // A failure here might indicate that the initial_state tries to call it's own initial_state
-        return (*initial_state)(t);  // Should fail if initial_state isn't initialized
-      } else {
-        return this->interpolate(t);
-      }
+      return evaluate(t, own_cursor);
     }
     
+    /* Same as operator()(t), for readers other than the integrator: all state is kept in
+     * 'cursor', so any number of threads can read concurrently, each with its own cursor,
+     * including while the integrator adds rows (see Series::available_rows()).
+     * Only published rows are used: never the fine buffer of a decimated series, the dense
+     * output or the provisional rows of adaptive integrators. Critical points are read from
+     * a snapshot replaced atomically when they change, but should normally all be registered
+     * before integrating.
+     */
+    XVector operator () (double t, Cursor& cursor) const;
+
+    /* Lookup cursors for the integrator, when a model reads the history at more than one
+     * delay per step. Coefficients are only reused between calls using the same cursor, so
+     * alternating history(t - tau1) and history(t - tau2) recomputes them on every call;
+     * giving each delay its own cursor restores the incremental update:
+     *   size_t c1 = history.add_cursor("tau1");  // Once, before integrating
+     *   ...
+     *   history(t - tau1, c1);                   // In the drift
+     * Apart from the cursor, these behave exactly as operator()(t) (same thread, fine buffer
+     * included). Adding a name twice returns the same cursor. Cursors persist across reset().
+     */
+    size_t add_cursor(const std::string& name="") {
+      if (name != "") {
+        std::map<std::string, size_t>::const_iterator found = lookup_cursor_names.find(name);
+        if (found != lookup_cursor_names.end()) {
+          return found->second;
+        }
+        lookup_cursor_names[name] = lookup_cursors.size();
+      }
+      lookup_cursors.emplace_back();
+      return lookup_cursors.size() - 1;
+    }
+    size_t cursor_index(const std::string& name) const {
+      std::map<std::string, size_t>::const_iterator found = lookup_cursor_names.find(name);
+      if (found == lookup_cursor_names.end()) {
+        throw std::out_of_range("No lookup cursor named '" + name + "'. Use add_cursor() first.");
+      }
+      return found->second;
+    }
+    size_t get_ncursors() const { return lookup_cursors.size(); }
+    XVector operator () (double t, size_t cursor) const {
+      assert(cursor < lookup_cursors.size());
+      return evaluate(t, lookup_cursors[cursor]);
+    }
+    /* Convenience form; the name is looked up on every call, so prefer the index in inner loops */
+    XVector operator () (double t, const std::string& cursor_name) const {
+      return evaluate(t, lookup_cursors[cursor_index(cursor_name)]);
+    }
+
     XVector interpolate(double t) const;
+    XVector interpolate(double t, Cursor& cursor) const;
+    /* Batched form, e.g. for resampling or plotting: row i of 'out' (preallocated with
+     * ts.size() rows and one column per component) receives the state at ts[i].
+     * Uses its own cursor, but reads the fine buffer and dense output as operator()(t) does,
+     * so don't call while integrating from another thread.
+     */
+    void interpolate(const std::vector<double>& ts, Eigen::Ref<Eigen::MatrixXd> out) const;
+    /* New series with the states at begin, begin + step, ..., end (the step is adjusted as
+     * by set_range), e.g. to bring the output of an adaptive integrator onto the uniform
+     * grid expected by histograms and spectral analysis. The interpolation is split over
+     * 'nthreads' threads (0: one per core) by chunks of time. To resample during the
+     * integration instead, attach a ResampleSink.
+     */
+    template <template <typename> class ResultStorage = TableStorage>
+    std::shared_ptr<InterpolatedSeries<XVector, order, ip, ResultStorage> >
+    resample(double begin, double end, double step, unsigned nthreads = 0) const;
     void add_critical_point(const double point, const double delay, const int max_criticality_order);
     void add_primary_critical_point(const double point, const double delay) {add_critical_point(point, delay, order);}
     void add_secondary_critical_point(const double point, const double delay) {add_critical_point(point, delay, order - 1);}
+    void register_delay(const double delay);
+    /* Discontinuity at 'point' (typically t0, where the initial state meets the solution)
+     * which is propagated along every registered delay, including those registered later:
+     * critical points are placed at 'point' plus any sum of fewer than
+     * 'max_criticality_order' delays. See update_critical_points().
+     */
+    void add_discontinuity(const double point, const int max_criticality_order=order);
+    double next_critical_point(double t) const;
+    const std::vector<double>& get_critical_points() const { return critical_points; }
+    double aligned_step(double max_step) const;
+    /* Register 'delay' (see register_delay) and return a tap reading the history at that delay */
+    DelayTap add_delay_tap(const double delay) {
+      register_delay(delay);
+      return DelayTap(this, delay);
+    }
     /* Reset all data in order to restart a new computation
      * Everything is reinitialized to 0 or empty, except the interpolation order, which is assumed to be the same.
      * If interpolation order is different, it should be changed separately.
      */
     void reset() {
-      v = 0;
-      for (auto itr=coeff.begin(); itr != coeff.end(); ++itr) {
-        *itr = XVector::Zero();   // Strictly speaking, should not be necessary
-      }
+      own_cursor = Cursor();
+      generation.n.fetch_add(1, std::memory_order_release);
+      clear_dense_output();
       critical_points.clear();
+      std::atomic_store(&shared_critical_points, std::make_shared<const std::vector<double> >());
+      explicit_points.clear();
+      discontinuities.clear();
+      delays.clear();
+      critical_hint = 0;
+      max_delay = 0;
+      this->set_retention(std::numeric_limits<double>::infinity(), 0);  // Keep everything until delays are registered again
+      this->recent.set_retention(0, ip + 1);
       
       super::reset();
     }
     
   private:
-    
-    mutable size_t v = 0;                           // Avoid using v=-1 : size_t is strictly positive
-    mutable std::array<XVector, ip> coeff;          // Making these two internal variables mutable allows calling interpolate as a const function
-    std::set<double> critical_points;
 
-    size_t getV(double t) const;
-    std::array<double, 2> getNeighbourCritPoints(double t) const;
-    void getLaplaceCoefficients() const;
-    void getNextLaplaceCoefficients() const;
-    XVector computePoly(double t) const;
+    /* Derivatives of a contiguous range of rows, identified by their absolute index
+     * (also used for the quartic terms of the dense output) */
+    struct Slopes {
+      std::deque<XVector, Eigen::aligned_allocator<XVector> > values;
+      size_t first = 0;
+
+      void add(size_t row, const XVector& dxdt) {
+        if (values.empty() or row != first + values.size()) {
+          values.clear();   // Restart at 'row', so that the range stays contiguous
+          first = row;
+        }
+        values.push_back(dxdt);
+      }
+      void discard_from(size_t row) {     // Follow rolled back rows
+        while (!values.empty() and first + values.size() > row) {
+          values.pop_back();
+        }
+      }
+      void discard_before(size_t row) {   // Follow storages which discard old rows
+        while (!values.empty() and first < row) {
+          values.pop_front();
+          ++first;
+        }
+      }
+      bool has(size_t row) const { return row >= first and row < first + values.size(); }
+      const XVector& operator[] (size_t row) const { return values[row - first]; }
+      bool empty() const { return values.empty(); }
+      void clear() { values.clear(); first = 0; }
+    };
+
+    mutable Cursor own_cursor;      // Used by operator()(t), i.e. by the integrator
+                                    // Making the cursor mutable allows calling interpolate as a const function
+    AtomicCount generation;         // Incremented by reset() and rollbacks of published rows, to invalidate outstanding cursors
+    size_t local_generation = 0;    // Incremented by every rollback; only checked by the integrator's cursors
+    mutable std::vector<Cursor> lookup_cursors;     // See add_cursor()
+    std::map<std::string, size_t> lookup_cursor_names;
+    Slopes slopes;                  // Dense output for the stored rows, see update(t, x, dxdt)
+    Slopes recent_slopes;           // Same, for the fine buffer
+    Slopes dense_terms;             // Quartic terms of the steps ending at each row, see update(t, x, dxdt, dense_term)
+    Slopes recent_dense_terms;      // Same, for the fine buffer
+    std::vector<double> critical_points;             // Sorted, without duplicates
+    // Copy of critical_points for concurrent readers, replaced (never modified) with std::atomic_store
+    std::shared_ptr<const std::vector<double> > shared_critical_points = std::make_shared<const std::vector<double> >();
+    std::vector<double> explicit_points;             // From add_critical_point
+    std::vector<std::pair<double, int> > discontinuities;   // From add_discontinuity: point, max criticality order
+    std::vector<double> delays;                      // Registered delays (absolute values), sorted
+    mutable size_t critical_hint = 0;                // For next_critical_point
+    double max_delay = 0;                           // Longest delay registered so far
+
+    XVector evaluate(double t, Cursor& cursor) const;
+    XVector interpolate_stored(double t, Cursor& cursor) const;
+    void clear_dense_output() {
+      slopes.clear();
+      recent_slopes.clear();
+      dense_terms.clear();
+      recent_dense_terms.clear();
+    }
+    template <class Nodes> bool interpolate_dense(const Nodes& nodes, const GridIndex& grid, const Slopes& slopes,
+                                                  const Slopes& terms, NodeCursor& cursor, double t, XVector& x) const;
+    // 'crit' is critical_points, or the snapshot of concurrent readers
+    template <class Nodes> XVector interpolate_nodes(const Nodes& nodes, const GridIndex& grid, const std::vector<double>& crit,
+                                                     NodeCursor& cursor, double t) const;
+    void update_critical_points();
+    static size_t next_critical_index(const std::vector<double>& crit, double t, size_t& hint);
+    template <class Nodes> size_t getV(const Nodes& nodes, const std::vector<double>& crit, NodeCursor& cursor, double t, size_t row) const;
+    template <class Nodes> std::array<double, 2> getNeighbourCritPoints(const Nodes& nodes, const std::vector<double>& crit,
+                                                                        double t, size_t& hint) const;
+    template <class Nodes> void getLaplaceCoefficients(const Nodes& nodes, NodeCursor& cursor) const;
+    template <class Nodes> void getNextLaplaceCoefficients(const Nodes& nodes, NodeCursor& cursor) const;
+    XVector computePoly(const NodeCursor& cursor, double t) const;
 
   protected:
-    std::shared_ptr<InterpolatedSeries<XVector, order, ip> > initial_state = NULL;
+    std::shared_ptr<InterpolatedSeries<XVector, order, ip, Storage> > initial_state = NULL;
 
   }; // End InterpolatedSeries
 
@@ -422,22 +977,56 @@ namespace frantic {
     }
     struct dump_to_text_t : public SaveHistory {
       ProbabilityDensity<XVector>* object;
+      unsigned nthreads;
+      int precision;
       dump_to_text_t(ProbabilityDensity<XVector>* containing_object,
                      const std::string& name = "density", bool include_labels = true,
-                     const std::string& format = ", ", int max_files = 100) {
+                     const std::string& format = ", ", int max_files = 100, unsigned nthreads = 1,
+                     int precision = 0) {
         object = containing_object;
         this->name = name;
         this->include_labels = include_labels,
         this->format = format;
         this->max_files = max_files;
+        this->nthreads = nthreads;
+        this->precision = precision;
       }
       virtual void operator() (const std::string& directory, const std::string& filename) {
-        object->HistCollection<XVector>::dump_to_text(directory, filename, include_labels, format, max_files);
+        object->HistCollection<XVector>::dump_to_text(directory, filename, include_labels, format, max_files,
+                                                      nthreads, precision);
       }
     };
     dump_to_text_t dump_to_text(const std::string& name = "density", bool include_labels = true,
-                                const std::string& format = ", ", int max_files = 100) {
-      return dump_to_text_t(this, name, include_labels, format, max_files);
+                                const std::string& format = ", ", int max_files = 100, unsigned nthreads = 1,
+                                int precision = 0) {
+      return dump_to_text_t(this, name, include_labels, format, max_files, nthreads, precision);
+    }
+    struct dump_to_binary_t : public SaveHistory {
+      ProbabilityDensity<XVector>* object;
+      dump_to_binary_t(ProbabilityDensity<XVector>* containing_object,
+                       const std::string& name = "density", int max_files = 100) {
+        object = containing_object;
+        this->name = name;
+        this->include_labels = true;
+        this->format = "binary";
+        this->max_files = max_files;
+      }
+      virtual void operator() (const std::string& directory, const std::string& filename) {
+        object->HistCollection<XVector>::dump_to_binary(directory, filename, max_files,
+                                                        object->t0, object->dt, object->nSteps);
+      }
+    };
+    dump_to_binary_t dump_to_binary(const std::string& name = "density", int max_files = 100) {
+      return dump_to_binary_t(this, name, max_files);
+    }
+    void read_from_binary(const std::string& directory, const std::string& filename) {
+      BinaryHeader header = HistCollection<XVector>::read_from_binary(directory, filename);
+      if (header.kind == BinaryHeader::HISTOGRAMS) {
+        t0 = header.t0;
+        dt = header.dt;
+        nSteps = header.nSteps;
+        tn = t0 + nSteps * dt;
+      }
     }
   };
 
@@ -8,65 +8,115 @@
  * Series class
  * --------------------------------------------------------------------------*/
 
-/*
+/* Return the index of the first row with time not less than 't' (the last row if there is none).
+ * Times are assumed to be sorted in increasing order; no check is made to this effect.
+ * 'nodes' can be any storage policy (or a class deriving from one), since only time(),
+ * first_line() and get_nlines() are used.
  */
-template <typename XVector> Series<XVector>::Series(const std::string& varname, size_t cmaxlines) :
-  o2scl::table<std::vector<double> >(cmaxlines) {
-  std::string rowstr;
-  rowstr = "t";
-  for(size_t i=1; i<=XVector::SizeAtCompileTime; ++i) {
-        rowstr += " " + varname + std::to_string(i);
+template <class Nodes> size_t lookup_row(const Nodes& nodes, double t) {
+  size_t lo = nodes.first_line();
+  size_t hi = nodes.get_nlines() - 1;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (nodes.time(mid) < t) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
   }
-  this->line_of_names(rowstr);
+  return lo;
 }
 
-/* Overloaded data adding function to allow using the XVector type
+/* Same as above, but when the rows lie on a uniform grid the row is computed from 'grid'
+ * and only checked against its neighbours, which makes the lookup O(1).
  */
-template <typename XVector> void Series<XVector>::set(size_t row, double t, const XVector& x) {
-  super::set(0, row, t);
-  for(size_t i=0; i<XVector::SizeAtCompileTime; ++i) {
-    super::set(i+1, row, x(i));
+template <class Nodes> size_t lookup_row(const Nodes& nodes, double t, const GridIndex& grid) {
+  if (!grid.is_uniform()) {
+    return lookup_row(nodes, t);
+  }
+  size_t first = nodes.first_line();
+  size_t last = nodes.get_nlines() - 1;
+  size_t row = grid.estimate(t, first, last);
+  while (row > first and nodes.time(row - 1) >= t) {
+    --row;
   }
+  while (row < last and nodes.time(row) < t) {
+    ++row;
+  }
+  return row;
 }
 
-/* Overloaded data adding function to allow using the XVector type
- * \todo: reinstate error checking
+/* Same as above, but on a non-uniform grid the search starts from 'hint' (typically the row
+ * found by the previous lookup) and widens exponentially, so its cost grows with the log of
+ * the distance to 'hint'. A sweep over increasing times then costs linear time in total.
  */
-template <typename XVector> void Series<XVector>::line_of_data(double t, const XVector& x) {
-  // Virtually a copy of void line_of_data() from o2scl/table.h
-  if (maxlines==0) inc_maxlines(5);
-  if (nlines>=maxlines) inc_maxlines(maxlines);
-
-  if (intp_set) {
-        intp_set=false;
-        delete si;
+template <class Nodes> size_t lookup_row(const Nodes& nodes, double t, const GridIndex& grid, size_t hint) {
+  if (grid.is_uniform()) {
+    return lookup_row(nodes, t, grid);
   }
-
-  if (nlines<maxlines && XVector::SizeAtCompileTime<=(atree.size())) {
-
-    set_nlines(nlines+1);
-    super::set(0, nlines-1, t);
-    for(size_t i=0; i<XVector::SizeAtCompileTime; ++i) {
-      super::set(i+1, nlines-1, x(i));
-	}
-
-	return;
+  size_t first = nodes.first_line();
+  size_t last = nodes.get_nlines() - 1;
+  hint = std::min(std::max(hint, first), last);
+  size_t lo, hi;   // Result in (lo, hi], or first
+  if (nodes.time(hint) < t) {
+    lo = hint;
+    size_t step = 1;
+    hi = std::min(hint + step, last);
+    while (hi < last and nodes.time(hi) < t) {
+      lo = hi;
+      step *= 2;
+      hi = std::min(hi + step, last);
+    }
+  } else {
+    hi = hint;
+    size_t step = 1;
+    while (hi > first and nodes.time(hi - std::min(step, hi - first)) >= t) {
+      hi -= std::min(step, hi - first);
+      step *= 2;
+    }
+    if (hi == first) {
+      return first;
+    }
+    lo = hi - std::min(step, hi - first);
+  }
+  ++lo;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (nodes.time(mid) < t) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
   }
+  return lo;
+}
 
-//  O2SCL_ERR("Not enough lines or columns in line_of_data().",exc_einval);
-  return;
+/*
+ */
+template <typename XVector, template <typename> class Storage>
+Series<XVector, Storage>::Series(const std::string& varname, size_t cmaxlines) :
+  Storage<XVector>(cmaxlines) {
+  std::string rowstr;
+  rowstr = "t";
+  for(size_t i=1; i<=XVector::SizeAtCompileTime; ++i) {
+        rowstr += " " + varname + std::to_string(i);
+  }
+  this->line_of_names(rowstr);
+  recent.set_retention(0, 1);  // Without interpolation, only the latest fine step is ever needed
 }
 
 /* Return the current state of the system, i.e. the XVector most recently
  * added to the table
  */
-template <typename XVector> XVector Series<XVector>::operator ()() const {
-  return getVectorAtTime(nlines);
+template <typename XVector, template <typename> class Storage>
+XVector Series<XVector, Storage>::operator ()() const {
+  return getVectorAtTime(this->get_nlines() - 1);
 }
 
 /* Shorthand for getting state vector at time t
  */
-template <typename XVector> XVector Series<XVector>::operator ()(const double t) const {
+template <typename XVector, template <typename> class Storage>
+XVector Series<XVector, Storage>::operator ()(const double t) const {
   return getVectorAtTime(t);
 }
 
@@ -76,11 +126,13 @@ template <typename XVector> XVector Series<XVector>::operator ()(const double t)
  * To save in the current directory, pass an empty string to 'directory'.
  * If the filename exists or cannot be opened, it is appended with a number and retried;
  * this proceded is repeated until file is successfully opened or 'max_files' is reached.
+ * Numbers are written with 'precision' significant digits, by default in the shortest form
+ * that reads back exactly (see io.h).
  * \todo: Add number before file extension
  * \todo: Add trailing '/' to directory if necessary
  */
-template <typename XVector>
-void Series<XVector>::dump_to_text_t::operator() (const std::string& directory,
+template <typename XVector, template <typename> class Storage>
+void Series<XVector, Storage>::dump_to_text_t::operator() (const std::string& directory,
                                                   const std::string& filename) {
   std::string outfilename = frantic::get_free_filename(directory, filename, max_files);  // Returns "" if unsuccessful
 
@@ -89,54 +141,14 @@ void Series<XVector>::dump_to_text_t::operator() (const std::string& directory,
     //    outfile.close();
     std::fstream outfile(outfilename.c_str(), std::ios::out);
 
-    std::array<std::string, 3> formatStrings = getFormatStrings(format);
-    std::string headChar = formatStrings[0];  // 1 or more characters that appears at the beginning of each line
-    std::string sepChar = formatStrings[1];   // 1 or more characters that appears between each element on a line
-    std::string tailChar = formatStrings[2];  // 1 or more characters that appears at the end of each line
-
-    // Begin file with description comments
-    outfile << "# Format: Time series" << std::endl;
-    outfile << "# Details: One column per time series" << std::endl;
-    outfile << "#          First column are the times" << std::endl;
-    if (include_labels) {
-      outfile << "# Row 1: Column names" << std::endl;
-      outfile << "# Column 1: timepoints" << std::endl;
-    }
-    outfile << "# -- Parsing info -- " << std::endl;
-    outfile << "# File info lines: " << 0 << std::endl;
-    outfile << "# Block info lines: " << (include_labels ? 1 : 0) << std::endl;
-    outfile << "# Number of blocks: " << 1 << std::endl;
-    outfile << "# Row info lines: " << 0 << std::endl;
-    outfile << "# Info columns: " << 1 << std::endl;
-
-    outfile << std::endl;
-    if (include_labels) {
-      std::string line = headChar;
-      std::string sepline = headChar;
-      for(size_t i=0; i<object->get_ncolumns() - 1; ++i) {
-        line = line + object->get_column_name(i) + sepChar;
-        sepline = sepline + std::string(object->get_column_name(i).length(), '-') + "-+";
-      }
-      line = line + object->get_column_name(object->get_ncolumns() - 1) + tailChar; // Don't put a sep character for last column
-      sepline = sepline + std::string(object->get_column_name(object->get_ncolumns() - 1).length(), '-') + tailChar;
-
-      if (format == "org") {
-        outfile << sepline << std::endl;
-        outfile << line << std::endl;
-        outfile << sepline << std::endl;
-      } else {
-        outfile << line << std::endl;
-      }
-    }
+    write_series_header(outfile, object->get_column_names(), include_labels, format);
 
-    for(size_t i=0; i<object->get_nlines(); ++i) {
-      outfile << headChar;
-      for(size_t j=0; j < object->get_ncolumns() - 1; ++j) {
-        outfile << object->get(j,i) << sepChar;
-      }
-      outfile << object->get(object->get_ncolumns() - 1, i) << tailChar;  // Don't put a sep character for last column
-      outfile << std::endl;
-    }
+    // Numbers are formatted in blocks (in parallel if nthreads != 1)
+    Series<XVector, Storage>* series = object;
+    size_t first = series->first_line();
+    write_text_rows(outfile, series->get_nlines() - first, series->get_ncolumns(),
+                    [series, first](size_t j, size_t i) { return series->get(j, first + i); },
+                    format, nthreads, precision);
 
     outfile.close();
 
@@ -147,142 +159,279 @@ void Series<XVector>::dump_to_text_t::operator() (const std::string& directory,
 
 }
 
-template <typename XVector>
-void Series<XVector>::read_from_text(const std::string& directory, const std::string& filename,
-                                     const std::string& format)
+/* Read a series written by dump_to_text with the same 'format'.
+ * The file is mapped and parsed in parallel on 'nthreads' threads (0: one per core);
+ * lines which are not data rows (comments, labels) are skipped.
+ * The range is reset based on the data.
+ */
+template <typename XVector, template <typename> class Storage>
+void Series<XVector, Storage>::read_from_text(const std::string& directory, const std::string& filename,
+                                     const std::string& format, unsigned nthreads)
 {
-  // \tood: format parameter currently ignored, due to issue in split
-  // \todo: see http://stackoverflow.com/questions/9371238/why-is-reading-lines-from-stdin-much-slower-in-c-than-python?rq=1  ?
-
   std::string basename = directory + "/";  // \todo: don't add if it's already there
   std::string infilename = basename + filename;
 
-  std::ifstream infile(infilename.c_str());
+  const size_t ncolumns = XVector::SizeAtCompileTime + 1;
+  TextTableReader reader(infilename, ncolumns, format, nthreads);
 
-  if (!infile.is_open()) {
+  if (!reader.is_open()) {
     std::cerr << "Couldn't find file " << infilename << "." << std::endl;
 
   } else {
     reset(true);   // True indicates to also reset the range
 
-    std::string line;
-    std::stringstream sstream;
-    double t;
-    XVector datavec;
-    std::vector<std::string> linetokens;
-    // \todo: make this work with the different output formats
-    while (std::getline(infile, line)) {
-       if (line.size() && line[0] != '#') {
-         // Line is not a comment; try to parse it into the expected number of tokens
-         linetokens.clear();
-         frantic::split(line, ' ', linetokens);  // \FIXME: Hardcoded token delimiter !!!!!!
-         if (linetokens.size() == XVector::SizeAtCompileTime + 1) {
-           // Line has the expected number of tokens; assume it's properly formatted
-           for(size_t i=0; i < XVector::SizeAtCompileTime; ++i) {
-             sstream.clear();
-             sstream << linetokens[i+1];       // We don't use stod here because it is locale dependent
-             sstream >> datavec[i];
-             //datavec[i] << linetokens[i+1];
-           }
-           sstream.clear();
-           sstream << linetokens[0];           // Same comment as above
-           sstream >> t;
-           line_of_data(t, datavec);
-         }
-       }
+    // Every row is one line, so the line count bounds the number of rows
+    size_t maxrows = reader.count_lines();
+    if (this->get_maxlines() < maxrows) {
+      this->inc_maxlines(maxrows - this->get_maxlines());
     }
-    set_range(get(0,0), get(0, get_nlines()-1), (long) get_nlines());  // Reset the range based on the data. Type specified to avoid ambiguous overload
-    // \todo: check that step size is consistent with data
 
-    infile.close();
+    reader.read([this, ncolumns](const double* values, size_t nrows) {
+        for(size_t i=0; i < nrows; ++i) {
+          const double* row = values + i * ncolumns;
+          line_of_data(row[0], Eigen::Map<const XVector>(row + 1));
+        }
+      });
+
+    if (this->get_nlines() > 0) {
+      // Reset the range based on the data. Type specified to avoid ambiguous overload
+      set_range(this->time(0), this->time(this->get_nlines()-1), (long) this->get_nlines() - 1);
+      // \todo: check that step size is consistent with data
+    }
   }
 
 }
 
-template <typename XVector> std::array<std::string, 3> Series<XVector>::getFormatStrings(std::string format) {
-  std::array<std::string, 3> formatStrings;
+/* Write the series in the binary format described in io.h.
+ * File naming follows dump_to_text.
+ */
+template <typename XVector, template <typename> class Storage>
+void Series<XVector, Storage>::dump_to_binary_t::operator() (const std::string& directory,
+                                                    const std::string& filename) {
+  std::string outfilename = frantic::get_free_filename(directory, filename, max_files);  // Returns "" if unsuccessful
 
-  if (format == "org") {
-      formatStrings[0] = "|";
-      formatStrings[1] = " |";
-      formatStrings[2] = "|";
-    } else {
-      // If it's not a special format, use the format string as separator
-      formatStrings[0] = "";
-      formatStrings[1] = format;
-      formatStrings[2] = "";
+  if (outfilename != "") {
+    std::ofstream outfile(outfilename.c_str(), std::ios::out | std::ios::binary);
+
+    BinaryHeader header;
+    header.kind = BinaryHeader::SERIES;
+    header.ncomponents = XVector::SizeAtCompileTime;
+    header.nrows = object->get_nlines() - object->first_line();
+    header.t0 = object->t0;
+    header.dt = object->dt;
+    header.nSteps = object->nSteps;
+    header.column_names = object->get_column_names();
+    header.write(outfile);
+
+    // Columns are gathered into a buffer and written in blocks
+    const size_t blocksize = 8192;
+    std::vector<double> buffer;
+    buffer.reserve(blocksize);
+    for(size_t j=0; j < object->get_ncolumns(); ++j) {
+      for(size_t i=object->first_line(); i < object->get_nlines(); ++i) {
+        buffer.push_back(object->get(j, i));
+        if (buffer.size() == blocksize) {
+          outfile.write(reinterpret_cast<const char*>(buffer.data()), buffer.size() * sizeof(double));
+          buffer.clear();
+        }
+      }
     }
+    outfile.write(reinterpret_cast<const char*>(buffer.data()), buffer.size() * sizeof(double));
 
-  return formatStrings;
+    outfile.close();
+
+    std::cout << "Series written to" << std::endl << outfilename << std::endl;
+  } else {
+    std::cerr << "Unable to open a file to export series data." << std::endl;
+  }
 }
 
-template <typename XVector> typename Series<XVector>::Statistics Series<XVector>::getStatistics() {
+/* Read a series written by dump_to_binary. The range (t0, dt, nSteps) is restored from the file.
+ * With MappedStorage the file is only mapped; other storages copy the rows.
+ * Throws std::runtime_error if the file is not a valid series with the same XVector size.
+ */
+template <typename XVector, template <typename> class Storage>
+void Series<XVector, Storage>::read_from_binary(const std::string& directory, const std::string& filename)
+{
+  std::string basename = directory + "/";  // \todo: don't add if it's already there
+  std::string infilename = basename + filename;
 
-  Statistics stats;
+  auto file = std::make_shared<MappedFile>(infilename);
+
+  if (!file->is_open()) {
+    std::cerr << "Couldn't find file " << infilename << "." << std::endl;
+
+  } else {
+    BinaryHeader header = BinaryHeader::read(file->data(), file->size());
+    if (header.kind != BinaryHeader::SERIES or header.ncomponents != XVector::SizeAtCompileTime) {
+      throw std::runtime_error(infilename + " does not contain a series with "
+                               + std::to_string(XVector::SizeAtCompileTime) + " components.");
+    }
 
-  stats.nsteps = this->get_nlines();
+    reset(true);   // True indicates to also reset the range
 
-  for(size_t i = 1; i <  this->get_ncolumns(); ++i) {
-      stats.max.push_back(this->max(i));
-      stats.min.push_back(this->min(i));
-      double sum = std::accumulate((*this)[i].begin(), (*this)[i].begin() + stats.nsteps, 0.0);
-      stats.mean.push_back(sum/this->get_nlines());
+    size_t nrows = header.nrows;
+    const double* columns = reinterpret_cast<const double*>(file->data() + header.data_offset);
+    if constexpr (is_mapped_storage<super>::value) {
+      this->attach(file, columns, nrows, header.column_names);
+      for(size_t row=0; row < nrows; ++row) {
+        grid.add(row, columns[row]);
+      }
+      publish();
+    } else {
+      if (this->get_maxlines() < nrows) {
+        this->inc_maxlines(nrows - this->get_maxlines());
+      }
+      XVector datavec;
+      for(size_t row=0; row < nrows; ++row) {
+        for(size_t i=0; i < XVector::SizeAtCompileTime; ++i) {
+          datavec(i) = columns[(i+1) * nrows + row];
+        }
+        line_of_data(columns[row], datavec);
+      }
+    }
+
+    t0 = header.t0;
+    dt = header.dt;
+    nSteps = header.nSteps;
+    tn = t0 + nSteps * dt;
   }
+}
 
+template <typename XVector, template <typename> class Storage>
+std::array<std::string, 3> Series<XVector, Storage>::getFormatStrings(std::string format) {
+  return get_format_strings(format);
+}
+
+template <typename XVector, template <typename> class Storage>
+typename Series<XVector, Storage>::Statistics Series<XVector, Storage>::getStatistics() {
 
+  Statistics stats;
+
+  // Without tracked statistics, accumulate them over the stored rows in a single pass
+  RunningStatistics<XVector> scanned;
+  if (!statistics_tracked) {
+    for(size_t irow = this->first_line(); irow < this->get_nlines(); ++irow) {
+      scanned.update(this->row(irow));
+    }
+  }
+  const RunningStatistics<XVector>& rs = statistics_tracked ? running_statistics : scanned;
+
+  stats.nsteps = rs.count();
+  XVector mean = rs.mean(), max = rs.max(), min = rs.min(), variance = rs.variance();
+  for(size_t i = 0; i < XVector::SizeAtCompileTime; ++i) {
+    stats.max.push_back(max(i));
+    stats.min.push_back(min(i));
+    stats.mean.push_back(mean(i));
+    stats.variance.push_back(variance(i));
+  }
 
   return stats;
 }
 
-template <typename XVector> XVector Series<XVector>::getVectorAtTime(const size_t t_idx) const {
-  static XVector retval;
-  for(size_t i=0; i<XVector::SizeAtCompileTime; ++i) {
-      retval(i) = get(i+1, t_idx);
-  };
-  return retval;
+template <typename XVector, template <typename> class Storage>
+XVector Series<XVector, Storage>::getVectorAtTime(const size_t t_idx) const {
+  return this->row(t_idx);
 }
 
 /* Convenience function that searches the history for a time 't' and returns the corresponding vector.
  * IMPORTANT: 't' must be _exactly_ equal to value in the series -- no interpolation is performed.
  * If you need interpolation, use the InterpolatedSeries class.
+ * Throws std::out_of_range if the series is empty, or if no row has time 't'.
  */
-template <typename XVector> XVector Series<XVector>::getVectorAtTime(const double t) const {
-    bool failed = false;
+template <typename XVector, template <typename> class Storage>
+XVector Series<XVector, Storage>::getVectorAtTime(const double t) const {
+    size_t nlines = this->get_nlines();
 
-    if (nlines < 2) {
-        // ordered lookup needs at least 2 rows
-        if (nlines == 0) {
-            std::cerr << "Attempted to query an empty series !" << std::endl;
-            assert(false);
-        } else {
-            if (this->get(0, 0) == t) {
-                return this->getVectorAtTime(static_cast<size_t>(0));
-            } else {
-                failed = true;
-            }
-        }
+    if (nlines == 0) {
+        throw std::out_of_range("Attempted to query an empty series.");
     }
-    size_t t_found_idx = this->ordered_lookup("t", t);  // ordered_lookup returns the closest index --
-    if (this->get(0, t_found_idx) == t) {
-      return this->getVectorAtTime(t_found_idx);
+    size_t t_found_idx;
+    if (nlines - this->first_line() < 2) {
+        // ordered lookup needs at least 2 rows
+        t_found_idx = this->first_line();
     } else {
-      failed = true;
+        t_found_idx = this->lookup_row(t);
+    }
+    if (this->time(t_found_idx) != t) {
+      throw std::out_of_range("Series data was read at time " + std::to_string(t) + ", which does not"
+                              " correspond to any time point. If you need interpolation between time"
+                              " points, use the InterpolatedSeries class.");
     }
+    return this->getVectorAtTime(t_found_idx);
+}
+
+template <typename XVector, template <typename> class Storage>
+size_t Series<XVector, Storage>::lookup_row(double t) const {
+  return frantic::lookup_row(*this, t, grid);
+}
 
-    if (failed) {
-      std::cerr << "You attempted to read series data at time " << t << ", which does not correspond to any time point." << std::endl;
-      std::cerr << "If you need interpolation between time points, use the InterpolatedSeries class." << std::endl;
-      assert(false);
+/* Set the first row of the series (and of the fine buffer, if recording is decimated)
+ */
+template <typename XVector, template <typename> class Storage>
+void Series<XVector, Storage>::set_initial_row(const XVector& x) {
+  set(0, t0, x);
+  recent.clear_data();
+  recent_grid.clear();
+  nupdates = 0;
+  next_record_time = 0;
+  recorded = true;
+  if (this->decimated()) {
+    recent.append_row(t0, x);
+    recent_grid.add(recent.get_nlines() - 1, t0);
+  }
+  write_sinks(t0, x);
+  running_statistics.reset();
+  if (statistics_tracked) {
+    running_statistics.update(x);
+  }
+}
+
+template <typename XVector, template <typename> class Storage>
+void Series<XVector, Storage>::add_sink(std::shared_ptr<SeriesSink<XVector> > sink) {
+  sink->open(get_column_names());
+  for(size_t irow=this->first_line(); irow < this->get_nlines(); ++irow) {
+    sink->write(this->time(irow), this->row(irow));
+  }
+  sinks.push_back(sink);
+}
+
+/* Called by update() when recording is decimated: returns true if the step
+ * reaching time 't' should be stored.
+ */
+template <typename XVector, template <typename> class Storage>
+bool Series<XVector, Storage>::record_step(double t) {
+  ++nupdates;
+  if (record_times.empty()) {
+    return (nupdates % record_stride == 0);
+  } else {
+    bool retval = false;
+    // Skip over all recording times within dt/2 of t, so that none is stored twice
+    while (next_record_time < record_times.size() and t >= record_times[next_record_time] - 0.5*std::abs(dt)) {
+      ++next_record_time;
+      retval = true;
     }
+    return retval;
+  }
 }
 
 // Convenience overloads
-template <typename XVector> double Series<XVector>::max(size_t icol) {
-  return this->max(this->get_column_name(icol));
+template <typename XVector, template <typename> class Storage>
+double Series<XVector, Storage>::max(size_t icol) const {
+  double retval = this->get(icol, this->first_line());
+  for(size_t irow = this->first_line() + 1; irow < this->get_nlines(); ++irow) {
+    retval = std::max(retval, this->get(icol, irow));
+  }
+  return retval;
 }
 
-template <typename XVector> double Series<XVector>::min(size_t icol) {
-  return this->min(this->get_column_name(icol));
+template <typename XVector, template <typename> class Storage>
+double Series<XVector, Storage>::min(size_t icol) const {
+  double retval = this->get(icol, this->first_line());
+  for(size_t irow = this->first_line() + 1; irow < this->get_nlines(); ++irow) {
+    retval = std::min(retval, this->get(icol, irow));
+  }
+  return retval;
 }
 
 
@@ -292,27 +441,283 @@ template <typename XVector> double Series<XVector>::min(size_t icol) {
    Python prototype code is in interpolation_prototype.py
    =================================================================== */
 
-template <typename XVector, int order, int ip> XVector InterpolatedSeries<XVector, order, ip>::interpolate(double t) const {
-  //const std::vector<double>& tcol = (*this)[0];
+/* Return the state at time t, interpolating between rows when required.
+ * When recording is decimated (see History::set_recording), lookups within the window of
+ * the fine buffer use the fine rows; older times fall back to the recorded (coarse) rows.
+ * Each source has its own interpolation cursor, so alternating between them doesn't
+ * invalidate the cached coefficients.
+ */
+template <typename XVector, int order, int ip, template <typename> class Storage>
+XVector InterpolatedSeries<XVector, order, ip, Storage>::interpolate(double t) const {
+  return interpolate_stored(t, own_cursor);
+}
 
-  // There's sometimes some offset between the actual series bounds and the requested ones, which can result in the assertion failing
-  if ((this->get(0,0) - super::dt <= t) and (t <= this->get(0,0))) { t = this->get(0,0); }
-  if ((this->get(0,this->get_nlines()-1) <= t) and  (t <= this->get(0,this->get_nlines()-1) + super::dt)) { t = this->get(0,this->get_nlines()-1); }
-  assert(t >= this->get(0,0) and t <= this->get(0,this->get_nlines()-1)); // Ensure we are interpolating within bounds
-
-  size_t t_found_idx;
-  if (t == 0) {
-    // If we set delay at 0, "t" column is filled with zeros and ordered_lookup fails for t=0. This hackishly circumvents that
-    // \todo: Make a cleaner solution
-    // \todo: FIXME!! Wrong if t[0] is not 0, e.g. for initial state. Currently only "ok" because we use constant initial function
-    t_found_idx = 0;
+template <typename XVector, int order, int ip, template <typename> class Storage>
+XVector InterpolatedSeries<XVector, order, ip, Storage>::interpolate_stored(double t, Cursor& cursor) const {
+  const size_t current = generation.n.load(std::memory_order_relaxed);   // Same thread as the writer
+  if (cursor.generation != current or cursor.local_generation != local_generation) {
+    cursor = Cursor();
+    cursor.generation = current;
+    cursor.local_generation = local_generation;
+  }
+  XVector x;
+  if (this->decimated() and this->recent.get_nlines() > 0
+      and t >= this->recent.time(this->recent.first_line())) {
+    if (!recent_slopes.empty() and interpolate_dense(this->recent, this->recent_grid, recent_slopes, recent_dense_terms, cursor.fine, t, x)) {
+      return x;
+    }
+    return interpolate_nodes(this->recent, this->recent_grid, critical_points, cursor.fine, t);
   } else {
-    // \todo: Might be a gain in speed if this is written from scratch (see docs), especially if we start from current position
-    //        Could also avoid problem of multiple 0 times, by returning first found one
-    t_found_idx = this->ordered_lookup("t", t);
+    if (!slopes.empty() and interpolate_dense(static_cast<const super&>(*this), this->grid, slopes, dense_terms, cursor.rows, t, x)) {
+      return x;
+    }
+    return interpolate_nodes(static_cast<const super&>(*this), this->grid, critical_points, cursor.rows, t);
   }
-  if (this->get(0, t_found_idx) == t) {
-    return this->getVectorAtTime(t_found_idx);
+}
+
+/* Cubic Hermite interpolation at t between the two rows around it, using their derivatives,
+ * plus the quartic term of that step if there is one.
+ * Returns false if t is outside the rows or either derivative is missing.
+ */
+template <typename XVector, int order, int ip, template <typename> class Storage>
+template <class Nodes>
+bool InterpolatedSeries<XVector, order, ip, Storage>::interpolate_dense(const Nodes& nodes, const GridIndex& grid,
+                                                                        const Slopes& slopes, const Slopes& terms,
+                                                                        NodeCursor& cursor, double t, XVector& x) const {
+  if (t < nodes.time(nodes.first_line()) or t > nodes.time(nodes.get_nlines()-1)) return false;
+
+  size_t k = frantic::lookup_row(nodes, t, grid, cursor.row);   // First row with time >= t
+  cursor.row = k;
+  if (nodes.time(k) == t) {
+    x = nodes.row(k);
+    return true;
+  }
+  if (k == nodes.first_line() or !slopes.has(k - 1) or !slopes.has(k)) return false;
+
+  double h = nodes.time(k) - nodes.time(k - 1);
+  double s = (t - nodes.time(k - 1)) / h;
+  double r = 1 - s;
+  x = (r*r*(1 + 2*s)) * nodes.row(k - 1) + (s*s*(3 - 2*s)) * nodes.row(k)
+      + (h*s*r*r) * slopes[k - 1] - (h*s*s*r) * slopes[k];
+  if (terms.has(k)) {
+    x += (s*s*r*r) * terms[k];
+  }
+  return true;
+}
+
+/* State at any time, including before t0 (from the initial state), using 'cursor' */
+template <typename XVector, int order, int ip, template <typename> class Storage>
+XVector InterpolatedSeries<XVector, order, ip, Storage>::evaluate(double t, Cursor& cursor) const {
+  if (t < History::t0) {
+    // Time precedes our current history ->
+    assert(initial_state != NULL);   // A failure here might indicate that the initial_state tries to call it's own initial_state
+    if (!cursor.initial) {
+      cursor.initial.reset(new Cursor());
+    }
+    return initial_state->evaluate(t, *cursor.initial);  // Should fail if initial_state isn't initialized
+  } else {
+    return interpolate_stored(t, cursor);
+  }
+}
+
+/* Evaluate at every time of 'ts', writing the state at ts[i] to row i of 'out'.
+ * The times are visited in increasing order (sorting a copy of their indices if 'ts' isn't
+ * already sorted) with a single cursor, so the interpolation stencil only moves forward and
+ * coefficients are updated incrementally; on sorted times the cost is linear in
+ * ts.size() + number of rows.
+ */
+template <typename XVector, int order, int ip, template <typename> class Storage>
+void InterpolatedSeries<XVector, order, ip, Storage>::interpolate(const std::vector<double>& ts, Eigen::Ref<Eigen::MatrixXd> out) const {
+  assert(out.rows() == Eigen::Index(ts.size()) and out.cols() == XVector::SizeAtCompileTime);
+  Cursor cursor;
+  auto evaluate_row = [&](size_t i) {
+    XVector x = evaluate(ts[i], cursor);
+    out.row(i) = Eigen::Map<const Eigen::RowVectorXd>(x.data(), x.size());
+  };
+
+  if (std::is_sorted(ts.begin(), ts.end())) {
+    for (size_t i=0; i < ts.size(); ++i) {
+      evaluate_row(i);
+    }
+  } else {
+    std::vector<size_t> sequence(ts.size());
+    std::iota(sequence.begin(), sequence.end(), 0);
+    std::sort(sequence.begin(), sequence.end(), [&ts](size_t a, size_t b) { return ts[a] < ts[b]; });
+    for (size_t i : sequence) {
+      evaluate_row(i);
+    }
+  }
+}
+
+template <typename XVector, int order, int ip, template <typename> class Storage>
+template <template <typename> class ResultStorage>
+std::shared_ptr<InterpolatedSeries<XVector, order, ip, ResultStorage> >
+InterpolatedSeries<XVector, order, ip, Storage>::resample(double begin, double end, double step, unsigned nthreads) const {
+  std::string varname = this->get_column_name(1);
+  varname.erase(varname.find_last_not_of("0123456789") + 1);   // Column names are varname + component number
+  auto result = std::make_shared<InterpolatedSeries<XVector, order, ip, ResultStorage> >(varname);
+  result->set_range(begin, end, step);
+
+  const size_t nrows = static_cast<size_t>(result->nSteps) + 1;
+  Eigen::MatrixXd values(nrows, XVector::SizeAtCompileTime);
+  const size_t chunk_rows = 16384;
+  const size_t nchunks = (nrows + chunk_rows - 1) / chunk_rows;
+  frantic::parallel_for(nchunks, nthreads, [&](size_t chunk) {
+      size_t first = chunk * chunk_rows;
+      size_t n = std::min(chunk_rows, nrows - first);
+      std::vector<double> ts(n);
+      for (size_t i=0; i < n; ++i) {
+        ts[i] = result->t0 + (first + i) * result->dt;
+      }
+      this->interpolate(ts, values.middleRows(first, n));   // Each call uses its own cursor
+    });
+
+  XVector x;
+  for (size_t row=0; row < nrows; ++row) {
+    for (size_t j=0; j < XVector::SizeAtCompileTime; ++j) {
+      x(j) = values(row, j);
+    }
+    result->set(row, result->t0 + row * result->dt, x);
+  }
+  return result;
+}
+
+template <typename XVector, int order, int ip, template <typename> class Storage>
+XVector InterpolatedSeries<XVector, order, ip, Storage>::interpolate(double t, Cursor& cursor) const {
+  const size_t current = generation.n.load(std::memory_order_acquire);
+  if (cursor.generation != current) {
+    cursor = Cursor();
+    cursor.generation = current;
+  }
+  RowsView<super> rows{*this, this->available_rows()};
+  std::shared_ptr<const std::vector<double> > crit = std::atomic_load(&shared_critical_points);
+  // The grid index is updated by the writer, so readers search instead
+  return interpolate_nodes(rows, GridIndex(), *crit, cursor.rows, t);
+}
+
+template <typename XVector, int order, int ip, template <typename> class Storage>
+XVector InterpolatedSeries<XVector, order, ip, Storage>::operator() (double t, Cursor& cursor) const {
+  if (t < History::t0) {
+    assert(initial_state != NULL);
+    if (!cursor.initial) {
+      cursor.initial.reset(new Cursor());
+    }
+    return (*initial_state)(t, *cursor.initial);
+  } else {
+    return interpolate(t, cursor);
+  }
+}
+
+/* --------------------------------------------------------------------------
+ * DelayTap
+ * --------------------------------------------------------------------------*/
+
+template <typename XVector, int order, int ip, template <typename> class Storage>
+XVector InterpolatedSeries<XVector, order, ip, Storage>::DelayTap::operator() (double t) const {
+  double tq = t - tau;
+  XVector x;
+  if (tq >= series->t0) {
+    if (series->decimated() and series->recent.get_nlines() > 0
+        and tq >= series->recent.time(series->recent.first_line())) {
+      if (series->recent_slopes.empty() and lookup_nodes(series->recent, series->recent_grid, tq, x)) return x;
+    } else {
+      if (series->slopes.empty() and lookup_nodes(static_cast<const super&>(*series), series->grid, tq, x)) return x;
+    }
+  }
+  return series->evaluate(tq, cursor);
+}
+
+/* Fixed-weight interpolation at 'tq' over 'nodes'. Returns false if the general path must be used. */
+template <typename XVector, int order, int ip, template <typename> class Storage>
+template <class Nodes>
+bool InterpolatedSeries<XVector, order, ip, Storage>::DelayTap::lookup_nodes(const Nodes& nodes, const GridIndex& grid,
+                                                                               double tq, XVector& x) const {
+  if (!grid.is_uniform() or tq > nodes.time(nodes.get_nlines() - 1)) return false;
+
+  // tq = time(k) + fraction * h, with k+1 the first row at or after tq
+  size_t next_row = frantic::lookup_row(nodes, tq, grid, row);
+  row = next_row;
+  if (nodes.time(next_row) == tq) {
+    x = nodes.row(next_row);
+    return true;
+  }
+  if (next_row == nodes.first_line()) return false;
+  const size_t k = next_row - 1;
+  const double h = nodes.time(next_row) - nodes.time(k);
+  const double fraction = (tq - nodes.time(k)) / h;
+
+  // Same nodes as getV: the first node above tq is the l-th from the end
+  const int l = int(ip / 2);
+  if (k + l + 2 < ip + nodes.first_line() or k + l + 2 > nodes.get_nlines()) return false;
+  const size_t s = k + l + 2 - ip;
+
+  // The weights assume equally spaced nodes; steps accumulated with t += dt drift away from
+  // a global grid, so the spacing is checked locally
+  const double ts = nodes.time(s);
+  for (int j=1; j < ip; ++j) {
+    if (std::abs(nodes.time(s + j) - ts - j * h) > tolerance * h) return false;
+  }
+
+  // Nodes may not straddle a critical point
+  size_t next = next_critical_index(series->critical_points, ts, crit);
+  if (next < series->critical_points.size() and series->critical_points[next] < nodes.time(s + ip - 1)) return false;
+
+  int w = 0;
+  while (w < nweights and !(std::abs(fraction - thetas[w]) <= tolerance)) ++w;
+  if (w == nweights) {
+    // Lagrange weights; node j is at (j + l + 2 - ip) steps from row k
+    w = next_weights;
+    next_weights = (next_weights + 1) % nweights;
+    for (int j=0; j < ip; ++j) {
+      double wj = 1;
+      for (int m=0; m < ip; ++m) {
+        if (m != j) {
+          wj *= (fraction - (m + l + 2 - ip)) / double(j - m);
+        }
+      }
+      weights[w][j] = wj;
+    }
+    thetas[w] = fraction;
+  }
+
+  x = weights[w][0] * nodes.row(s);
+  for (int j=1; j < ip; ++j) {
+    x += weights[w][j] * nodes.row(s + j);
+  }
+  return true;
+}
+
+/* Interpolate at t using the rows of 'nodes', which can be any object providing the
+ * time(), row(), first_line() and get_nlines() functions of a storage policy.
+ * 'grid' tracks whether these rows are uniformly spaced, in which case the row at t is
+ * found in constant time; otherwise it is searched for.
+ */
+template <typename XVector, int order, int ip, template <typename> class Storage>
+template <class Nodes>
+XVector InterpolatedSeries<XVector, order, ip, Storage>::interpolate_nodes(const Nodes& nodes, const GridIndex& grid,
+                                                                          const std::vector<double>& crit,
+                                                                          NodeCursor& cursor, double t) const {
+  //const std::vector<double>& tcol = (*this)[0];
+
+  const double tfirst = nodes.time(nodes.first_line());
+  const double tlast = nodes.time(nodes.get_nlines()-1);
+
+  if (nodes.first_line() > 0 and t < tfirst) {
+    // Storage has discarded the rows we would need (e.g. RingStorage with a delay longer than registered)
+    throw std::out_of_range("Cannot interpolate at t=" + std::to_string(t) + ": history before t="
+                            + std::to_string(tfirst) + " has been discarded. Was the longest delay registered ?");
+  }
+  // There's sometimes some offset between the actual series bounds and the requested ones, which can result in the assertion failing
+  if ((tfirst - super::dt <= t) and (t <= tfirst)) { t = tfirst; }
+  if ((tlast <= t) and  (t <= tlast + super::dt)) { t = tlast; }
+  assert(t >= tfirst and t <= tlast); // Ensure we are interpolating within bounds
+
+  // Returns the first row with time >= t, so repeated times (e.g. a zero-length initial
+  // state) resolve to the first of them
+  size_t t_found_idx = frantic::lookup_row(nodes, t, grid, cursor.row);
+  cursor.row = t_found_idx;
+  if (nodes.time(t_found_idx) == t) {
+    return nodes.row(t_found_idx);
   }
 
  /* if (t_found_idx > 0) {
@@ -321,18 +726,18 @@ template <typename XVector, int order, int ip> XVector InterpolatedSeries<XVecto
   }*/
 
   //this->v = ip - 2;  // DEBUG ONLY !!!!
-  size_t v = this->getV(t);
-  if (v != this->v) {
-        if (v == this->v + 1) {  // \todo: make sure reset in getV never makes this accidentally verified
-	  this->v = v;
-	  this->getNextLaplaceCoefficients();
+  size_t v = this->getV(nodes, crit, cursor, t, t_found_idx);
+  if (v != cursor.v) {
+        if (v == cursor.v + 1) {  // \todo: make sure reset in getV never makes this accidentally verified
+	  cursor.v = v;
+	  this->getNextLaplaceCoefficients(nodes, cursor);
 	} else {
-	  this->v = v;
-	  this->getLaplaceCoefficients();
+	  cursor.v = v;
+	  this->getLaplaceCoefficients(nodes, cursor);
 	}
   }
 
-  return this->computePoly(t);
+  return this->computePoly(cursor, t);
 }
 
 
@@ -342,37 +747,41 @@ template <typename XVector, int order, int ip> XVector InterpolatedSeries<XVecto
          (It used to in this case be able to choose points such that all but
          the first are on same side of interpolated point; I *think* this is fixed now, somewhat overzealously.)
 */
-template <typename XVector, int order, int ip> size_t InterpolatedSeries<XVector, order, ip>::getV(double t) const {
+template <typename XVector, int order, int ip, template <typename> class Storage>
+template <class Nodes>
+size_t InterpolatedSeries<XVector, order, ip, Storage>::getV(const Nodes& nodes, const std::vector<double>& crit,
+                                                             NodeCursor& cursor, double t, size_t row) const {
   //const std::vector<double>& tcol = (*this)[0];
-  static size_t v;    // temporary placeholder: this->v must not be modified
-  static size_t m;    // Maximum value to which we have integrated
-  static const int l = int(ip / 2);   // Half of the interpolation with
-  static std::array<double, 2> xi;
+  const int l = int(ip / 2);   // Half of the interpolation with
 
-  v = this->v;
-  m = this->get_nlines();
-  xi = this->getNeighbourCritPoints(t);
+  size_t v = cursor.v;                // temporary placeholder: cursor.v must not be modified (only cursor.crit)
+  size_t m = nodes.get_nlines();      // Maximum value to which we have integrated
+  std::array<double, 2> xi = this->getNeighbourCritPoints(nodes, crit, t, cursor.crit);
 
   // Check if v is already too high, and reset to lowest possible value
   // \todo: make 'reverse' function for this case, instead of just restarting ?
   //        If values are going backwards, this test might still be insufficient, or overkill (see above)
-  if (v < ip - 1) {
-      v = ip - 1;
-    } else if (this->get(0, v - l) > t) {
-      while(this->get(0, v - ip + 1) > t) {
-        // Somewhat agressive resetting of v
-        --v;
+  // 'row' is the first row after t (found by the caller), so the walks over rows, which used to
+  // make large jumps O(distance), are replaced by jumps to where they would end
+  if (v < nodes.first_line() + ip - 1) {
+      v = nodes.first_line() + ip - 1;
+    } else if (nodes.time(v - l) > t) {
+      if (nodes.time(v - ip + 1) > t) {
+        // Somewhat agressive resetting of v: to the last v whose first node is not after t
+        v = row + ip - 2;
       }
   }
+  // Rows before 'row' are before t and before xi[1], so the loops below would go through them
+  v = std::max(v, row - 1);
 
 
-  while (this->get(0, v) < xi[0]) {
+  while (nodes.time(v) < xi[0]) {
 	// Increase v until we've past the closest crit point less than t
 	++v;
   }
 
 
-  while (this->get(0, v - l) <= t and v < m and this->get(0,v) < xi[1]) {
+  while (nodes.time(v - l) <= t and v < m and nodes.time(v) < xi[1]) {
 	// Increase v until t is middle of interpolation interval, or we hit a bound
 	++v;
   }
@@ -382,112 +791,133 @@ template <typename XVector, int order, int ip> size_t InterpolatedSeries<XVector
 
 /* Given a time t, return the closest critical point below, and the closest critical point above, as an array:
  * std::array<double, 2>({below, above})
+ * 'hint' is the position found by the previous call with the same cursor (see next_critical_index).
  * Throws an error if 't' is a critical point (should not try to interpolate in this case)
- * \todo: Treat the case of no critical point (.begin() == .end())
  * \todo: Make sure distance between points is large enough to interpolate
  */
-template <typename XVector, int order, int ip> typename std::array<double, 2> InterpolatedSeries<XVector, order, ip>::getNeighbourCritPoints(double t) const {
+template <typename XVector, int order, int ip, template <typename> class Storage>
+template <class Nodes>
+typename std::array<double, 2> InterpolatedSeries<XVector, order, ip, Storage>::getNeighbourCritPoints(const Nodes& nodes,
+                                                                                                      const std::vector<double>& crit,
+                                                                                                      double t, size_t& hint) const {
 
-  static double nextCritPoint, prevCritPoint;
+  double nextCritPoint, prevCritPoint;
 
-  if (critical_points.size() == 0) {
+  if (crit.size() == 0) {
     // There are no critical points, so just return the begin and end times
-    nextCritPoint = this->get(0, this->get_nlines()-1);
-    prevCritPoint = this->get(0,0);
+    nextCritPoint = nodes.time(nodes.get_nlines()-1);
+    prevCritPoint = nodes.time(nodes.first_line());
   } else {
 
-    static std::set<double>::iterator CritPointItr;
-    CritPointItr = critical_points.upper_bound(t); // Returns first element greater than t, or .end() if none
-    //  this->neighbourCritPointItr[0] = std::prev(this->neighbourCritPointItr[1]);
+    size_t next = next_critical_index(crit, t, hint);  // First element greater than t, or size() if none
     // We shouldn't need to check for getting critical point beyond current t, because that's what the 'm' does in getV()
 
+    assert(next == 0 or crit[next - 1] != t);
+    assert(next != 0);   // The initial point should always be a critical point for DDEs, and if we are evaluating at it *exactly*, we don't need to interpolate.
 
-    assert(*(std::prev(CritPointItr)) != t );
-    assert(CritPointItr != critical_points.begin());   // The initial point should always be a critical point for DDEs, and if we are evaluating at it *exactly*, we don't need to interpolate.
-
-
-    // \todo Would something like the code below be more efficient, since we expect in general to only go to the next critical point ?
-    //  if (this->critPoints(this->neighbourCritPointIdxs[1]) < t) {
-    //	while (this->critPoints(this->neighbourCritPointIdxs[1]) < t) {
-    //	  ++(this->neighbourCritPointIdxs[1]);
-    //	}
-    //  } else if (this->critPoints(this->neighbourCritPointIdxs[0]) > t) {
-    //	while (this->critPoints(this->neighbourCritPointIdxs[0]) > t) {
-    //	  --(this->neighbourCritPointIdxs[0]);
-    //	}
-    //  }
-
-    // \todo: Avoid creating array by having the member already existing in Series
-    if (CritPointItr == critical_points.end()) {
-      nextCritPoint = this->get(0, this->get_nlines()-1);
+    if (next == crit.size()) {
+      nextCritPoint = nodes.time(nodes.get_nlines()-1);
     } else {
-      nextCritPoint = *CritPointItr;
+      nextCritPoint = crit[next];
     }
-    CritPointItr--;
-    if (CritPointItr == critical_points.begin()) {
-      prevCritPoint = this->get(0,0);
+    if (next <= 1) {
+      prevCritPoint = nodes.time(nodes.first_line());
     } else {
-      prevCritPoint = *CritPointItr;
+      prevCritPoint = crit[next - 1];
     }
   }
 
   return std::array<double, 2>({prevCritPoint, nextCritPoint});
 }
 
-template <typename XVector, int order, int ip> void InterpolatedSeries<XVector, order, ip>::getLaplaceCoefficients() const {
-  size_t& v = this->v;
-//  const std::vector<double>& tcol = (*this)[0];
-
-  static std::array<XVector, ip-1> d;
-
-  this->coeff[0] = this->getVectorAtTime(v);
-
-  assert(v - ip + 1 >= 0); // must have at least ip points behind v to interpolate with
-	
-  int i, n;
-  for(i=0; i < ip - 1; ++i) {
-        d[i] = (this->getVectorAtTime(v - i - 1) - this->getVectorAtTime(v - i))
-          / (this->get(0, v - i - 1) - this->get(0, v - i));
+/* Index of the first critical point of 'crit' strictly after t (crit.size() if there is none).
+ * The search starts from 'hint', which is updated, so that sequential queries (as made by
+ * integrators, going forward in time) cost O(1); arbitrary jumps fall back to a binary search.
+ */
+template <typename XVector, int order, int ip, template <typename> class Storage>
+size_t InterpolatedSeries<XVector, order, ip, Storage>::next_critical_index(const std::vector<double>& crit, double t, size_t& hint) {
+  const size_t n = crit.size();
+  size_t i = std::min(hint, n);
+  if ((i < n and crit[i] <= t and i + 2 < n and crit[i + 2] <= t)
+      or (i > 1 and crit[i - 2] > t)) {
+    // Far from the previous position
+    i = std::upper_bound(crit.begin(), crit.end(), t) - crit.begin();
+  } else {
+    while (i < n and crit[i] <= t) ++i;
+    while (i > 0 and crit[i - 1] > t) --i;
   }
+  hint = i;
+  return i;
+}
 
-  this->coeff[1] = d[0];
+/* Newton coefficients of the polynomial through the nodes v - ip + 1, ..., v (v = cursor.v),
+ * by divided differences. Loops are unrolled at compile time (see unroll), the node times are
+ * cached in the cursor for computePoly and getNextLaplaceCoefficients, and the operations on
+ * XVector are vectorized by Eigen across components.
+ */
+template <typename XVector, int order, int ip, template <typename> class Storage>
+template <class Nodes>
+void InterpolatedSeries<XVector, order, ip, Storage>::getLaplaceCoefficients(const Nodes& nodes, NodeCursor& cursor) const {
+  const size_t v = cursor.v;
+  std::array<double, ip>& times = cursor.times;   // times[j] is the time of node v - ip + 1 + j
 
-  for(n=2; n < ip; ++n) {
-	for(i=0; i < ip - n; ++i) {
-	  d[i] = ( d[i+1] - d[i] ) / (this->get(0, v - i - n) - this->get(0, v - i));
-	}
+  assert(v >= nodes.first_line() + ip - 1); // must have at least ip points behind v to interpolate with
 
-	this->coeff[n] = d[0];
-  }
-}
+  unroll<ip>([&](auto j) { times[j] = nodes.time(v - ip + 1 + j); });
 
-template <typename XVector, int order, int ip> void InterpolatedSeries<XVector, order, ip>::getNextLaplaceCoefficients() const {
-  size_t& v = this->v;
-//  const std::vector<double>& tcol = (*this)[0];
+  std::array<XVector, ip-1> d;
 
-  std::array<XVector, ip> oldCoeff(this->coeff);
+  cursor.coeff[0] = nodes.row(v);
 
-  this->coeff[0] = this->getVectorAtTime(v);
+  unroll<ip - 1>([&](auto i) {
+      d[i] = (nodes.row(v - i - 1) - nodes.row(v - i))
+        / (times[ip - 2 - i] - times[ip - 1 - i]);
+    });
 
-  int i;
-  for(i=1; i < ip - 1; ++i) {
-        this->coeff[i] = (oldCoeff[i-1] - this->coeff[i-1])/(this->get(0, v - i) - this->get(0, v));
-  }
+  cursor.coeff[1] = d[0];
 
-  this->coeff[ip - 1] = (oldCoeff[ip-2] - this->coeff[ip-2])/(this->get(0, v - ip + 1) - this->get(0, v));
+  unroll<ip - 2>([&](auto n_) {
+      constexpr int n = decltype(n_)::value + 2;
+      unroll<ip - n>([&](auto i) {
+          d[i] = ( d[i+1] - d[i] ) / (times[ip - 1 - i - n] - times[ip - 1 - i]);
+        });
+      cursor.coeff[n] = d[0];
+    });
 }
 
-/* Use Hörner's algorithm to compute the interpolation polynomial.
- * This function does no checking, so make sure coefficients are properly calculated beforehand.
- * \todo: Any way to implement this using only temporaries, i.e. in one line without the loop ?
+/* Coefficients for v = cursor.v from those for v - 1, adding node v and dropping node
+ * v - ip. Updated in place, so each old coefficient is kept only until it has been used.
  */
-template <typename XVector, int order, int ip> XVector InterpolatedSeries<XVector, order, ip>::computePoly(double t) const {
-//  const std::vector<double>& tcol = (*this)[0];
+template <typename XVector, int order, int ip, template <typename> class Storage>
+template <class Nodes>
+void InterpolatedSeries<XVector, order, ip, Storage>::getNextLaplaceCoefficients(const Nodes& nodes, NodeCursor& cursor) const {
+  const size_t v = cursor.v;
+  std::array<double, ip>& times = cursor.times;
+
+  unroll<ip - 1>([&](auto j) { times[j] = times[j + 1]; });
+  times[ip - 1] = nodes.time(v);
+
+  XVector previous = cursor.coeff[0];   // Coefficient i-1 for the nodes ending at v - 1
+  cursor.coeff[0] = nodes.row(v);
+
+  unroll<ip - 1>([&](auto i_) {
+      constexpr int i = decltype(i_)::value + 1;
+      XVector old = cursor.coeff[i];
+      cursor.coeff[i] = (previous - cursor.coeff[i-1])/(times[ip - 1 - i] - times[ip - 1]);
+      previous = old;
+    });
+}
 
-  XVector b = this->coeff[ip - 1];
-  for(int i=0; i < ip - 1; ++i) {
-        b = (t - this->get(0, this->v - ip + 2 + i))*b + coeff[ip - 2 - i];
-  }
+/* Use Hörner's algorithm to compute the interpolation polynomial, with the node times cached
+ * in the cursor.
+ * This function does no checking, so make sure coefficients are properly calculated beforehand.
+ */
+template <typename XVector, int order, int ip, template <typename> class Storage>
+XVector InterpolatedSeries<XVector, order, ip, Storage>::computePoly(const NodeCursor& cursor, double t) const {
+  XVector b = cursor.coeff[ip - 1];
+  unroll<ip - 1>([&](auto i) {
+      b = (t - cursor.times[i + 1])*b + cursor.coeff[ip - 2 - i];
+    });
 
   return b;
 }
@@ -496,11 +926,110 @@ template <typename XVector, int order, int ip> XVector InterpolatedSeries<XVecto
  * 'point' is the t (independant variable) at the point
  * 'delay' is the value  of the delay (or distance between each successively induced point)
  * 'max_criticality_order' is the total number of critical points (including the first) induced */
-template <typename XVector, int order, int ip>
-void InterpolatedSeries<XVector, order, ip>::add_critical_point(const double point, const double delay, const int max_criticality_order) {
+template <typename XVector, int order, int ip, template <typename> class Storage>
+void InterpolatedSeries<XVector, order, ip, Storage>::add_critical_point(const double point, const double delay, const int max_criticality_order) {
   for(int i=0; i < max_criticality_order; ++i) {
-    critical_points.insert(point + i*delay);
+    explicit_points.push_back(point + i*delay);
+  }
+  register_delay(delay);   // Also updates critical_points
+}
+
+/* Record that the process looks back by 'delay'. Storage policies which discard old rows
+ * (e.g. RingStorage) are told to keep at least the longest registered delay, plus the rows
+ * needed for the interpolation stencil. Discontinuities are propagated along the new delay.
+ */
+template <typename XVector, int order, int ip, template <typename> class Storage>
+void InterpolatedSeries<XVector, order, ip, Storage>::register_delay(const double delay) {
+  max_delay = std::max(max_delay, std::abs(delay));
+  this->set_retention(max_delay, ip + 1);
+  this->recent.set_retention(max_delay, ip + 1);
+  if (delay != 0 and std::find(delays.begin(), delays.end(), std::abs(delay)) == delays.end()) {
+    delays.push_back(std::abs(delay));
+    std::sort(delays.begin(), delays.end());
+  }
+  update_critical_points();
+}
+
+template <typename XVector, int order, int ip, template <typename> class Storage>
+void InterpolatedSeries<XVector, order, ip, Storage>::add_discontinuity(const double point, const int max_criticality_order) {
+  discontinuities.push_back(std::make_pair(point, max_criticality_order));
+  update_critical_points();
+}
+
+/* Rebuild critical_points from the explicit points and from the propagation of each
+ * discontinuity: a discontinuity at 'point' in the n-th derivative appears in the (n+1)-th
+ * derivative at point + tau, for every registered delay tau. Points are therefore generated
+ * for every sum of fewer than 'max_criticality_order' delays (each combination once, delays
+ * taken in increasing order). Points closer than rounding errors are merged.
+ */
+template <typename XVector, int order, int ip, template <typename> class Storage>
+void InterpolatedSeries<XVector, order, ip, Storage>::update_critical_points() {
+  std::vector<double> points(explicit_points);
+  std::vector<std::pair<double, size_t> > level, next_level;   // (point, index of the last delay added)
+  for (const std::pair<double, int>& discontinuity : discontinuities) {
+    level.assign(1, std::make_pair(discontinuity.first, size_t(0)));
+    for (int depth=0; depth < discontinuity.second and !level.empty(); ++depth) {
+      next_level.clear();
+      for (const std::pair<double, size_t>& node : level) {
+        points.push_back(node.first);
+        if (depth + 1 < discontinuity.second) {
+          for (size_t j=node.second; j < delays.size(); ++j) {
+            next_level.push_back(std::make_pair(node.first + delays[j], j));
+          }
+        }
+      }
+      level.swap(next_level);
+    }
+  }
+
+  std::sort(points.begin(), points.end());
+  critical_points.clear();
+  for (double point : points) {
+    if (critical_points.empty()
+        or point - critical_points.back() > 1e-12 * std::max(1.0, std::abs(point))) {
+      critical_points.push_back(point);
+    }
+  }
+  std::atomic_store(&shared_critical_points, std::make_shared<const std::vector<double> >(critical_points));
+}
+
+/* First critical point after t, or infinity if there is none */
+template <typename XVector, int order, int ip, template <typename> class Storage>
+double InterpolatedSeries<XVector, order, ip, Storage>::next_critical_point(double t) const {
+  size_t next = next_critical_index(critical_points, t, critical_hint);
+  return (next < critical_points.size()) ? critical_points[next] : std::numeric_limits<double>::infinity();
+}
+
+/* Largest step not exceeding 'max_step' for which every critical point falls on the time
+ * grid t0 + n*step, so that fixed-step integrators land exactly on them. This requires the
+ * delays and the offsets of the discontinuities from t0 to be commensurate; steps down to
+ * max_step / 100 are tried, after which 'max_step' is returned unchanged.
+ */
+template <typename XVector, int order, int ip, template <typename> class Storage>
+double InterpolatedSeries<XVector, order, ip, Storage>::aligned_step(double max_step) const {
+  std::vector<double> spans(delays);
+  for (const std::pair<double, int>& discontinuity : discontinuities) {
+    if (discontinuity.first != this->t0) spans.push_back(std::abs(discontinuity.first - this->t0));
+  }
+  for (double point : explicit_points) {
+    if (point != this->t0) spans.push_back(std::abs(point - this->t0));
+  }
+  if (spans.empty()) return max_step;
+
+  const double shortest = *std::min_element(spans.begin(), spans.end());
+  for (long n = std::max(1L, long(std::ceil(shortest / max_step))); n <= 100 * std::ceil(shortest / max_step); ++n) {
+    double step = shortest / n;
+    bool aligned = true;
+    for (double span : spans) {
+      double multiple = span / step;
+      if (std::abs(multiple - std::round(multiple)) > 1e-6) {   // Off the grid by more than rounding errors
+        aligned = false;
+        break;
+      }
+    }
+    if (aligned) return step;
   }
+  return max_step;
 }
 
 #endif
@@ -0,0 +1,105 @@
+/* Linearization of the drift, for the implicit integrators
+ */
+
+#ifndef IMPLICIT_H
+#define IMPLICIT_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+#include <utility>
+
+#include <eigen3/Eigen/Dense>
+
+namespace frantic {
+
+  /* True if the Differential provides its own Jacobian, i.e.
+   *   Matrix jacobian(double t, const XVector& x, const XHistory& history) const
+   * returning the derivative of drift(t, x, history) with respect to x (delayed values held fixed).
+   */
+  template <class Differential, class = void>
+  struct has_jacobian : std::false_type {};
+  template <class Differential>
+  struct has_jacobian<Differential,
+                      std::void_t<decltype(std::declval<const Differential&>().jacobian(
+                                             0.0, std::declval<const typename Differential::XVector&>(),
+                                             std::declval<const typename Differential::XHistory&>()))> >
+    : std::true_type {};
+
+  /* Jacobian J of the drift with respect to the current state, and the LU factorization of
+   * I - gamma*J used by the implicit integrators to solve their linear systems.
+   * The Jacobian is taken from Differential::jacobian if there is one (see has_jacobian),
+   * and otherwise computed by forward differences of the drift, one evaluation per component.
+   * Delayed values are not differentiated: lookups in the history are held fixed, so stiffness
+   * must come from the instantaneous terms (as for a strong relaxation -alpha*x).
+   * Both are kept until explicitly refreshed: integrators reuse the Jacobian across steps
+   * (it only needs to be approximate for W-methods and Newton iterations), and factorize()
+   * only refactors when gamma changed since the last factorization or the Jacobian was updated.
+   */
+  template <class Differential>
+  class Linearization
+  {
+    using XVector = typename Differential::XVector;
+    using XHistory = typename Differential::XHistory;
+  public:
+    using Matrix = Eigen::Matrix<double, XVector::RowsAtCompileTime, XVector::RowsAtCompileTime>;
+
+    /* Compute the Jacobian at (t, x); 'dxdt' is the drift there, already known to the caller. */
+    void update_jacobian(const Differential& dX, double t, const XVector& x, const XVector& dxdt,
+                         const XHistory& history) {
+      if constexpr (has_jacobian<Differential>::value) {
+        J = dX.jacobian(t, x, history);
+      } else {
+        const Eigen::Index n = x.size();
+        J.resize(n, n);
+        XVector xp = x;
+        for (Eigen::Index j=0; j < n; ++j) {
+          double delta = std::sqrt(std::numeric_limits<double>::epsilon()) * std::max(std::abs(x(j)), 1.0);
+          xp(j) = x(j) + delta;
+          delta = xp(j) - x(j);     // Exactly representable step
+          J.col(j) = (dX.drift(t, xp, history) - dxdt) / delta;
+          xp(j) = x(j);
+        }
+      }
+      ++njacobians;
+      factorized = false;
+    }
+    bool jacobian_computed() const { return njacobians > 0; }
+
+    /* Factorize I - gamma*J, unless that's already done */
+    void factorize(double gamma) {
+      assert(jacobian_computed());
+      if (factorized and gamma == lu_gamma) return;
+      lu.compute(Matrix::Identity(J.rows(), J.cols()) - gamma * J);
+      lu_gamma = gamma;
+      factorized = true;
+      ++nfactorizations;
+    }
+    /* Solve (I - gamma*J) y = rhs, with the gamma of the last factorization */
+    XVector solve(const XVector& rhs) const {
+      assert(factorized);
+      return lu.solve(rhs);
+    }
+
+    const Matrix& jacobian() const { return J; }
+    size_t get_njacobians() const { return njacobians; }
+    size_t get_nfactorizations() const { return nfactorizations; }
+    void reset() {
+      factorized = false;
+      njacobians = 0;
+      nfactorizations = 0;
+    }
+
+  private:
+    Matrix J;
+    Eigen::PartialPivLU<Matrix> lu;
+    double lu_gamma = 0;
+    bool factorized = false;
+    size_t njacobians = 0;
+    size_t nfactorizations = 0;
+  };
+
+}
+
+#endif // IMPLICIT_H
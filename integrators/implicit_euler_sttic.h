@@ -0,0 +1,127 @@
+#ifndef IMPLICIT_EULER_STTIC_H
+#define IMPLICIT_EULER_STTIC_H
+
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+#include "integrator.h"
+#include "implicit.h"
+
+using std::vector;
+
+namespace integrators {
+
+  /* Drift-implicit Euler-Maruyama integrator for stiff stochastic differential equations
+   * (weak order: 1, strong order : 1/2), i.e. the theta method on the drift:
+   *   x_{n+1} = x_n + [theta f(t_{n+1}, x_{n+1}) + (1-theta) f(t_n, x_n)] dt + g(t_n, x_n) dW
+   * theta = 1 (the default) is fully implicit, 1/2 the trapezoidal rule.
+   * Same interface as Euler_sttic; the step is the history's dt, which must not exceed the
+   * shortest registered delay.
+   * The implicit equation is solved by a simplified Newton iteration with the Jacobian of the
+   * drift (see frantic::Linearization). Since the step is fixed, the LU factorization of
+   * I - theta*dt*J is computed once and reused until the Jacobian is recomputed, which is done
+   * every 'jacobian_age' steps and when the iteration doesn't converge.
+   */
+  template <class Differential>
+  class ImplicitEuler_sttic : public frantic::Integrator<Differential>
+  {
+  private:
+    using XVector = typename Differential::XVector;
+
+  public:
+
+    using frantic::Integrator<Differential>::Integrator;  // Allow parent class overloads
+    ImplicitEuler_sttic<Differential>() : frantic::Integrator<Differential>() {
+      this->order = 0.5;
+    }
+    virtual ~ImplicitEuler_sttic() {}
+
+    void set_theta(double value) {
+      assert(value >= 0 and value <= 1);
+      theta = value;
+    }
+    /* The iteration stops once the correction is below tol * (1 + |x|) in every component */
+    void set_newton_tolerance(double tol) {
+      assert(tol > 0);
+      newton_tol = tol;
+    }
+    void set_jacobian_age(size_t nsteps) {
+      assert(nsteps > 0);
+      jacobian_age = nsteps;
+    }
+    const frantic::Linearization<Differential>& get_linearization() const { return linearization; }
+
+    /* Given a total derivative functor dX, integrate the DE problem. */
+    void integrate(const Differential& dX) {
+      auto& history = this->history;
+
+      assert(history.check_initialized());
+      if (history.dt > history.get_min_delay()) {
+        std::cerr << "ImplicitEuler_sttic: the time step (" << history.dt << ") is longer than the shortest delay ("
+                  << history.get_min_delay() << ")." << std::endl;
+        assert(false);
+      }
+
+      const double dt = history.dt;
+      double t = history.t0;
+      XVector x = history(t);
+      linearization.reset();
+      size_t steps_since_jacobian = jacobian_age;   // Compute it on the first step
+
+      for (ptrdiff_t i=0; i < history.nSteps; ++i) {   // nSteps is the number of steps from t0 to tn
+        const XVector dxdt = dX.drift(t, x, history);
+        if (steps_since_jacobian >= jacobian_age) {
+          linearization.update_jacobian(dX, t, x, dxdt, history);
+          steps_since_jacobian = 0;
+        }
+        const XVector rhs = x + ((1 - theta) * dt) * dxdt
+                            + dX.diffusion_coeffs(t, x, history).sum_products(dX.diffusion_differentials(dt));
+        const XVector guess = rhs + (theta * dt) * dxdt;   // Explicit Euler-Maruyama
+        XVector x_next = guess;
+
+        if (!solve(dX, t + dt, dt, rhs, x_next)) {
+          // Retry from the same guess with an up to date Jacobian
+          x_next = guess;
+          linearization.update_jacobian(dX, t, x, dxdt, history);
+          steps_since_jacobian = 0;
+          if (!solve(dX, t + dt, dt, rhs, x_next)) {
+            throw std::runtime_error("ImplicitEuler_sttic: Newton iteration did not converge at t="
+                                     + std::to_string(t) + ". Try a smaller time step.");
+          }
+        }
+
+        x = x_next;
+        t += dt;
+        ++steps_since_jacobian;
+        history.update(t, x);
+      }
+    }
+
+  protected:
+    double theta = 1;
+    double newton_tol = 1e-10;
+    size_t jacobian_age = 20;
+    int max_iterations = 10;
+    frantic::Linearization<Differential> linearization;
+
+    /* Simplified Newton iteration for x - theta*dt*f(t, x) = rhs, starting from 'x' */
+    bool solve(const Differential& dX, double t, double dt, const XVector& rhs, XVector& x) {
+      if (theta == 0) {
+        x = rhs;
+        return true;
+      }
+      const double gamma = theta * dt;
+      linearization.factorize(gamma);
+      for (int iteration=0; iteration < max_iterations; ++iteration) {
+        XVector delta = linearization.solve(rhs + gamma * dX.drift(t, x, this->history) - x);
+        x += delta;
+        if ((delta.array().abs() <= newton_tol * (1 + x.array().abs())).all()) return true;
+      }
+      return false;
+    }
+  };
+
+}
+
+#endif // IMPLICIT_EULER_STTIC_H
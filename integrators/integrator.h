@@ -14,13 +14,16 @@
 
 #include <cmath>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <stdexcept>
 #include <utility>
 #include <vector>
 #include <functional>
 #include <algorithm>
 #include <string>
 #include <map>
+#include <type_traits>
 #include <assert.h>
 
 #include <o2scl/table.h>
@@ -42,6 +45,90 @@ using namespace::Eigen;
 namespace frantic {
 
 
+  /* State of an ensemble of N independent realizations of a system whose state is XVector,
+   * one column per member, integrated together on a single time grid. Use it as the XVector
+   * of a Differential written in ensemble form: drift and diffusion coefficients return one
+   * column per member (typically the same expression as for a single member, evaluated on
+   * the whole matrix), and diffusion differentials are row vectors with one independent
+   * increment per member (see noise_product in stochastic.h).
+   * Histories then store all members in each row, on a shared time column, and each delayed
+   * lookup computes one set of interpolation weights for the whole ensemble. The stochastic
+   * integrators (Euler_sttic, Milstein_sttic, SRA_sttic) need no other change.
+   * Per-member statistics are accumulated with update_columns (see RunningStatistics and
+   * HistCollection), with the member type XVector.
+   * N is fixed at compile time, since storages lay out rows by XVector::SizeAtCompileTime;
+   * keep components * N within Eigen's limit for fixed size objects (EIGEN_STACK_ALLOCATION_LIMIT).
+   */
+  template <class XVector, int N>
+  using Ensemble = Eigen::Matrix<double, XVector::SizeAtCompileTime, N>;
+
+  /* True if the history type accepts dense output, i.e. provides update(t, x, dxdt)
+   * (see InterpolatedSeries). Histories which override update(t, x) without forwarding
+   * the three argument form don't.
+   */
+  template <class XHistory, class XVector, class = void>
+  struct accepts_slopes : std::false_type {};
+  template <class XHistory, class XVector>
+  struct accepts_slopes<XHistory, XVector,
+                        std::void_t<decltype(std::declval<XHistory&>().update(0.0, std::declval<const XVector&>(),
+                                                                              std::declval<const XVector&>()))> >
+    : std::true_type {};
+  /* Same, for the quartic term of a continuous extension, i.e. update(t, x, dxdt, dense_term) */
+  template <class XHistory, class XVector, class = void>
+  struct accepts_dense_terms : std::false_type {};
+  template <class XHistory, class XVector>
+  struct accepts_dense_terms<XHistory, XVector,
+                             std::void_t<decltype(std::declval<XHistory&>().update(0.0, std::declval<const XVector&>(),
+                                                                                   std::declval<const XVector&>(),
+                                                                                   std::declval<const XVector&>()))> >
+    : std::true_type {};
+
+  /* Step size limits and truncation, shared by the adaptive integrators.
+   * Each step is cut short to end exactly on the next critical point of the history, or on tn,
+   * so that no step straddles a discontinuity of the solution's derivatives. Steps are never
+   * longer than hmax; if the error control asks for a step shorter than hmin, std::runtime_error
+   * is thrown. hmin bounds the step asked for, not the truncated one: closely spaced critical
+   * points (e.g. induced by several delays) legitimately make truncated steps much shorter.
+   */
+  class StepControl
+  {
+  public:
+    double hmin = 0;
+    double hmax = std::numeric_limits<double>::infinity();
+
+    void set_limits(double min, double max) {
+      assert(0 <= min and min < max);
+      hmin = min;
+      hmax = max;
+    }
+
+    /* Step to try from t, given the step h asked for by the error control */
+    template <class XHistory>
+    double truncate(const XHistory& history, double t, double h) {
+      tend = std::min(history.next_critical_point(t), history.tn);
+      truncated = (t + h >= tend);
+      h_try = truncated ? tend - t : h;
+      return h_try;
+    }
+    /* Throws if h is below hmin, or if the step to try no longer moves t */
+    void check_min(const std::string& method, double t, double h) const {
+      if (h < hmin or t + h_try == t) {
+        throw std::runtime_error(method + ": step size underflow at t=" + std::to_string(t)
+                                 + ". Tolerances may be too strict.");
+      }
+    }
+    /* True if the step to try ends on a critical point (or tn) rather than where the error
+     * control would: it then says nothing about the step size the solution allows */
+    bool is_truncated() const { return truncated; }
+    /* Time at the end of the step to try, once accepted from t */
+    double end(double t) const { return truncated ? tend : t + h_try; }
+
+  private:
+    double tend = 0;
+    double h_try = 0;
+    bool truncated = false;
+  };
+
   /* XVector should be a class derived from Eigen/Matrix
    * XHistory is the type of the series for the result variable (mostly, whether interpolated (and with how many points) or not)
    * \todo: Implement move semantics
@@ -95,6 +182,28 @@ namespace frantic {
 
   protected:
     float order; // Integrator order. Also provided for O2scl compatibility (but it should be converted to int)
+
+    /* Record a step along with the derivative at its end, which the history uses as dense
+     * output if it can (see accepts_slopes); otherwise the derivative is dropped. */
+    void record_step(double t, const XVector& x, const XVector& dxdt) {
+      if constexpr (accepts_slopes<XHistory, XVector>::value) {
+        history.update(t, x, dxdt);
+      } else {
+        history.update(t, x);
+      }
+    }
+    void record_step(double t, const XVector& x, const XVector& dxdt, const XVector& dense_term) {
+      if constexpr (accepts_dense_terms<XHistory, XVector>::value) {
+        history.update(t, x, dxdt, dense_term);
+      } else {
+        record_step(t, x, dxdt);
+      }
+    }
+    void record_initial_slope(const XVector& dxdt) {
+      if constexpr (accepts_slopes<XHistory, XVector>::value) {
+        history.set_initial_slope(dxdt);
+      }
+    }
   };
 
 #include "integrator.tpp"
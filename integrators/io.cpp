@@ -1,3 +1,13 @@
+#include <assert.h>
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "io.h"
 
 /* Return a file object for writing.
@@ -57,4 +67,411 @@ namespace frantic
       return elems;
   }
 
+  std::array<std::string, 3> get_format_strings(const std::string& format) {
+    std::array<std::string, 3> formatStrings;
+
+    if (format == "org") {
+      formatStrings[0] = "|";
+      formatStrings[1] = " |";
+      formatStrings[2] = "|";
+    } else {
+      // If it's not a special format, use the format string as separator
+      formatStrings[0] = "";
+      formatStrings[1] = format;
+      formatStrings[2] = "";
+    }
+
+    return formatStrings;
+  }
+
+  /* Write the description comments and (optionally) the column labels which begin
+   * a series text file. The parsing info block is read by the analysis scripts, so its
+   * layout should not be changed.
+   */
+  void write_series_header(std::ostream& outfile, const std::vector<std::string>& column_names,
+                           bool include_labels, const std::string& format) {
+    std::array<std::string, 3> formatStrings = get_format_strings(format);
+    std::string headChar = formatStrings[0];  // 1 or more characters that appears at the beginning of each line
+    std::string sepChar = formatStrings[1];   // 1 or more characters that appears between each element on a line
+    std::string tailChar = formatStrings[2];  // 1 or more characters that appears at the end of each line
+
+    // Begin file with description comments
+    outfile << "# Format: Time series" << std::endl;
+    outfile << "# Details: One column per time series" << std::endl;
+    outfile << "#          First column are the times" << std::endl;
+    if (include_labels) {
+      outfile << "# Row 1: Column names" << std::endl;
+      outfile << "# Column 1: timepoints" << std::endl;
+    }
+    outfile << "# -- Parsing info -- " << std::endl;
+    outfile << "# File info lines: " << 0 << std::endl;
+    outfile << "# Block info lines: " << (include_labels ? 1 : 0) << std::endl;
+    outfile << "# Number of blocks: " << 1 << std::endl;
+    outfile << "# Row info lines: " << 0 << std::endl;
+    outfile << "# Info columns: " << 1 << std::endl;
+
+    outfile << std::endl;
+    if (include_labels) {
+      size_t ncols = column_names.size();
+      std::string line = headChar;
+      std::string sepline = headChar;
+      for(size_t i=0; i<ncols - 1; ++i) {
+        line = line + column_names[i] + sepChar;
+        sepline = sepline + std::string(column_names[i].length(), '-') + "-+";
+      }
+      line = line + column_names[ncols - 1] + tailChar; // Don't put a sep character for last column
+      sepline = sepline + std::string(column_names[ncols - 1].length(), '-') + tailChar;
+
+      if (format == "org") {
+        outfile << sepline << std::endl;
+        outfile << line << std::endl;
+        outfile << sepline << std::endl;
+      } else {
+        outfile << line << std::endl;
+      }
+    }
+  }
+
+
+  /* --------------------------------------------------------------------------
+   * ChunkWriter
+   * --------------------------------------------------------------------------*/
+
+  ChunkWriter::ChunkWriter(const std::string& filename, size_t ncolumns, const std::string& format,
+                           size_t max_pending, int precision)
+    : outfile(filename.c_str(), std::ios::out), ncolumns(ncolumns),
+      format(format), max_pending(max_pending), precision(precision) {
+    assert(ncolumns > 0 and max_pending > 0);
+    thread = std::thread(&ChunkWriter::run, this);
+  }
+
+  ChunkWriter::~ChunkWriter() {
+    close();
+  }
+
+  std::vector<double> ChunkWriter::get_buffer() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<double> buffer;
+    if (!spare.empty()) {
+      buffer.swap(spare.back());
+      spare.pop_back();
+    }
+    buffer.clear();
+    return buffer;
+  }
+
+  void ChunkWriter::submit(std::vector<double>&& chunk) {
+    assert(chunk.size() % ncolumns == 0);
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this]{ return pending.size() < max_pending; });
+    pending.push_back(std::move(chunk));
+    cv.notify_all();
+  }
+
+  void ChunkWriter::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this]{ return pending.empty() and writing == 0; });
+    outfile.flush();
+  }
+
+  void ChunkWriter::close() {
+    if (thread.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+      }
+      cv.notify_all();
+      thread.join();   // The thread empties the queue before returning
+    }
+    if (outfile.is_open()) {
+      outfile.close();
+    }
+  }
+
+  void ChunkWriter::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      cv.wait(lock, [this]{ return stop or !pending.empty(); });
+      if (pending.empty()) {
+        break;   // stop was requested and everything is written
+      }
+      std::vector<double> chunk;
+      chunk.swap(pending.front());
+      pending.pop_front();
+      ++writing;
+      cv.notify_all();   // Room in the queue
+
+      lock.unlock();
+      write_chunk(chunk);
+      lock.lock();
+
+      --writing;
+      spare.push_back(std::move(chunk));
+      cv.notify_all();
+    }
+  }
+
+  void ChunkWriter::write_chunk(const std::vector<double>& chunk) {
+    // Same formatting as Series::dump_to_text
+    write_text_rows(outfile, chunk.size() / ncolumns, ncolumns,
+                    [this, &chunk](size_t j, size_t i) { return chunk[i * ncolumns + j]; }, format,
+                    1, precision);
+  }
+
+  /* --------------------------------------------------------------------------
+   * MappedFile
+   * --------------------------------------------------------------------------*/
+
+  MappedFile::MappedFile(const std::string& filename) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return;
+
+    struct stat info;
+    if (fstat(fd, &info) == 0) {
+      length = info.st_size;
+      if (length == 0) {
+        opened = true;   // Nothing to map
+      } else {
+        address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address == MAP_FAILED) {
+          address = nullptr;
+          length = 0;
+        } else {
+          opened = true;
+        }
+      }
+    }
+    ::close(fd);   // The mapping remains valid after closing the descriptor
+  }
+
+  void MappedFile::close() {
+    if (address != nullptr) {
+      munmap(address, length);
+    }
+    address = nullptr;
+    length = 0;
+    opened = false;
+  }
+
+
+  /* --------------------------------------------------------------------------
+   * TextTableReader
+   * --------------------------------------------------------------------------*/
+
+  namespace {
+    bool is_space(char c) { return c == ' ' or c == '\t' or c == '\r'; }
+    const char* skip_space(const char* p, const char* end) {
+      while (p < end and is_space(*p)) ++p;
+      return p;
+    }
+    std::string strip(const std::string& str) {
+      size_t first = 0, last = str.size();
+      while (first < last and is_space(str[first])) ++first;
+      while (last > first and is_space(str[last - 1])) --last;
+      return str.substr(first, last - first);
+    }
+    // Match 'token' at p, returning the position after it, or nullptr if it isn't there
+    const char* match(const char* p, const char* end, const std::string& token) {
+      if (static_cast<size_t>(end - p) < token.size() or std::memcmp(p, token.data(), token.size()) != 0) {
+        return nullptr;
+      }
+      return p + token.size();
+    }
+  }
+
+  TextTableReader::TextTableReader(const std::string& filename, size_t ncolumns, const std::string& format,
+                                   unsigned nthreads)
+    : file(filename), ncolumns(ncolumns), nthreads(nthreads) {
+    assert(ncolumns > 0);
+    std::array<std::string, 3> formatStrings = get_format_strings(format);
+    head = strip(formatStrings[0]);
+    sep = strip(formatStrings[1]);    // Empty for whitespace separated columns
+    tail = strip(formatStrings[2]);
+  }
+
+  size_t TextTableReader::count_lines() const {
+    std::vector<size_t> bounds = chunk_bounds();
+    std::vector<size_t> counts(bounds.size() - 1);
+    parallel_for(counts.size(), nthreads, [&](size_t i) {
+        counts[i] = std::count(file.data() + bounds[i], file.data() + bounds[i+1], '\n');
+      });
+    size_t nlines = std::accumulate(counts.begin(), counts.end(), size_t(0));
+    if (file.size() > 0 and file.data()[file.size() - 1] != '\n') {
+      ++nlines;   // Last line has no terminating newline
+    }
+    return nlines;
+  }
+
+  void TextTableReader::read(const std::function<void(const double*, size_t)>& consume) const {
+    std::vector<size_t> bounds = chunk_bounds();
+    size_t nchunks = bounds.size() - 1;
+    unsigned nbuffers = (nthreads == 0) ? default_nthreads() : nthreads;
+    std::vector<std::vector<double> > buffers(std::min<size_t>(nbuffers, nchunks));
+
+    // Chunks are parsed one batch at a time, so only as many chunks as threads are held in memory
+    for (size_t first_chunk=0; first_chunk < nchunks; first_chunk += buffers.size()) {
+      size_t nbatch = std::min(buffers.size(), nchunks - first_chunk);
+      parallel_for(nbatch, nthreads, [&](size_t b) {
+          buffers[b].clear();
+          parse_chunk(file.data() + bounds[first_chunk + b], file.data() + bounds[first_chunk + b + 1], buffers[b]);
+        });
+      for (size_t b=0; b < nbatch; ++b) {
+        consume(buffers[b].data(), buffers[b].size() / ncolumns);
+      }
+    }
+  }
+
+  /* Offsets splitting the file into chunks of about 16 MB, each ending just after a newline */
+  std::vector<size_t> TextTableReader::chunk_bounds() const {
+    const size_t chunksize = 1 << 24;
+    std::vector<size_t> bounds(1, 0);
+    size_t size = file.size();
+    while (bounds.back() < size) {
+      size_t pos = std::min(bounds.back() + chunksize, size);
+      const char* newline = static_cast<const char*>(std::memchr(file.data() + pos, '\n', size - pos));
+      bounds.push_back(newline == nullptr ? size : newline - file.data() + 1);
+    }
+    return bounds;
+  }
+
+  void TextTableReader::parse_chunk(const char* begin, const char* end, std::vector<double>& values) const {
+    std::vector<double> row(ncolumns);
+    const char* line = begin;
+    while (line < end) {
+      const char* newline = static_cast<const char*>(std::memchr(line, '\n', end - line));
+      const char* line_end = (newline == nullptr) ? end : newline;
+      if (parse_line(line, line_end, row.data())) {
+        values.insert(values.end(), row.begin(), row.end());
+      }
+      line = line_end + 1;
+    }
+  }
+
+  /* Returns false if the line is not a data row */
+  bool TextTableReader::parse_line(const char* p, const char* end, double* row) const {
+    p = skip_space(p, end);
+    if (p == end or *p == '#') return false;
+    if (!head.empty()) {
+      p = match(p, end, head);
+      if (p == nullptr) return false;
+    }
+
+    for (size_t j=0; j < ncolumns; ++j) {
+      p = skip_space(p, end);
+      if (j > 0 and !sep.empty()) {
+        p = match(p, end, sep);
+        if (p == nullptr) return false;
+        p = skip_space(p, end);
+      }
+      std::from_chars_result result = std::from_chars(p, end, row[j]);
+      if (result.ec != std::errc()) return false;
+      p = result.ptr;
+    }
+
+    p = skip_space(p, end);
+    if (!tail.empty()) {
+      p = match(p, end, tail);
+      if (p == nullptr) return false;
+      p = skip_space(p, end);
+    }
+    return p == end;   // Lines with extra columns are not rows of this table
+  }
+
+
+  /* --------------------------------------------------------------------------
+   * BinaryHeader
+   * --------------------------------------------------------------------------*/
+
+  namespace {
+    const char binary_magic[8] = {'F', 'R', 'A', 'N', 'T', 'I', 'C', '\0'};
+    const uint64_t byte_order_mark = 0x0102030405060708;
+
+    template <typename T> void write_value(std::ostream& out, const T& value) {
+      out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+    template <typename T> T read_value(const char* data, size_t size, size_t& pos) {
+      if (pos + sizeof(T) > size) {
+        throw std::runtime_error("Binary file is truncated: header is incomplete.");
+      }
+      T value;
+      std::memcpy(&value, data + pos, sizeof(T));
+      pos += sizeof(T);
+      return value;
+    }
+  }
+
+  void BinaryHeader::write(std::ostream& out) {
+    std::streampos begin = out.tellp();
+    out.write(binary_magic, sizeof(binary_magic));
+    write_value(out, version);
+    write_value(out, static_cast<uint32_t>(kind));
+    write_value(out, byte_order_mark);
+    write_value(out, ncomponents);
+    write_value(out, nrows);
+    write_value(out, nbins);
+    write_value(out, t0);
+    write_value(out, dt);
+    write_value(out, nSteps);
+    write_value(out, static_cast<uint64_t>(column_names.size()));
+    for (auto& name : column_names) {
+      write_value(out, static_cast<uint64_t>(name.size()));
+      out.write(name.data(), name.size());
+    }
+
+    size_t length = out.tellp() - begin;
+    data_offset = (length + 63) / 64 * 64;
+    std::string padding(data_offset - length, '\0');
+    out.write(padding.data(), padding.size());
+  }
+
+  BinaryHeader BinaryHeader::read(const char* data, size_t size) {
+    BinaryHeader header;
+    size_t pos = 0;
+
+    if (size < sizeof(binary_magic) or std::memcmp(data, binary_magic, sizeof(binary_magic)) != 0) {
+      throw std::runtime_error("Not a FRANTIC binary file.");
+    }
+    pos += sizeof(binary_magic);
+    if (read_value<uint32_t>(data, size, pos) != version) {
+      throw std::runtime_error("Unsupported FRANTIC binary file version.");
+    }
+    header.kind = static_cast<Kind>(read_value<uint32_t>(data, size, pos));
+    if (read_value<uint64_t>(data, size, pos) != byte_order_mark) {
+      throw std::runtime_error("Binary file was written with a different byte order.");
+    }
+    header.ncomponents = read_value<uint64_t>(data, size, pos);
+    header.nrows = read_value<uint64_t>(data, size, pos);
+    header.nbins = read_value<uint64_t>(data, size, pos);
+    header.t0 = read_value<double>(data, size, pos);
+    header.dt = read_value<double>(data, size, pos);
+    header.nSteps = read_value<double>(data, size, pos);
+    uint64_t nnames = read_value<uint64_t>(data, size, pos);
+    for (uint64_t i=0; i < nnames; ++i) {
+      uint64_t length = read_value<uint64_t>(data, size, pos);
+      if (pos + length > size) {
+        throw std::runtime_error("Binary file is truncated: header is incomplete.");
+      }
+      header.column_names.push_back(std::string(data + pos, length));
+      pos += length;
+    }
+
+    header.data_offset = (pos + 63) / 64 * 64;
+    if (header.data_offset + header.data_size() > size) {
+      throw std::runtime_error("Binary file is truncated: expected " + std::to_string(header.data_size())
+                               + " bytes of data.");
+    }
+    return header;
+  }
+
+  size_t BinaryHeader::data_size() const {
+    switch (kind) {
+    case SERIES:
+      return (1 + ncomponents) * nrows * sizeof(double);
+    case HISTOGRAMS:
+      return (nrows + ncomponents * nrows * (2*nbins + 2)) * sizeof(double);
+    default:
+      return 0;
+    }
+  }
+
 }
@@ -6,9 +6,19 @@
 #include <sstream>
 #include <string>
 #include <vector>
+#include <array>
+#include <charconv>        // Required for std::to_chars
+#include <cstdint>
+#include <deque>
+#include <functional>
 #include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <Eigen/Dense>
 
+#include "parallel.h"
+
 namespace frantic
 {
 
@@ -18,6 +28,210 @@ namespace frantic
   std::vector<std::string> &split(const std::string &s, char delim, std::vector<std::string> &elems);
   std::vector<std::string> split(const std::string &s, char delim);
 
+  /* Text format helpers shared by the series and histogram writers.
+   * get_format_strings returns {line head, separator, line tail} for a format string:
+   * "org" produces an org-mode table, anything else is used as separator.
+   * Numbers: the text writers (Series::dump_to_text, HistCollection::dump_to_text and
+   * SpillToText) take a 'precision', passed down to append_number. With precision 0, the
+   * default, numbers are written in the shortest form that reads back to the same double, so
+   * the text is an exact copy of the data (e.g. 0.1 or 1.0000000000000002). Otherwise they
+   * have 'precision' significant digits, as with std::ostream's default formatting; 6 gives
+   * the format of earlier versions, i.e. that of 'out << value'.
+   */
+  std::array<std::string, 3> get_format_strings(const std::string& format);
+  void write_series_header(std::ostream& out, const std::vector<std::string>& column_names,
+                           bool include_labels, const std::string& format);
+
+  /* Append 'value' to 'buffer', with 'precision' significant digits (0: shortest round-trip form) */
+  inline void append_number(std::string& buffer, double value, int precision=0) {
+    char chars[32];
+    std::to_chars_result result = (precision > 0)
+      ? std::to_chars(chars, chars + sizeof(chars), value, std::chars_format::general, precision)
+      : std::to_chars(chars, chars + sizeof(chars), value);
+    buffer.append(chars, result.ptr);
+  }
+
+  /* Write 'nblocks' blocks of text to 'out', in order. format_block(b, buffer) should
+   * append the text of block b to 'buffer'; blocks are formatted on 'nthreads' threads
+   * (0: one per core), one batch of 'nthreads' blocks at a time, so that at most that
+   * many block buffers are held in memory. Buffers are reused between batches.
+   */
+  template <typename FormatBlock>
+  void write_blocks(std::ostream& out, size_t nblocks, FormatBlock format_block, unsigned nthreads=1) {
+    if (nthreads == 0) nthreads = default_nthreads();
+    std::vector<std::string> buffers(std::min<size_t>(nthreads, nblocks));
+    for (size_t first_block=0; first_block < nblocks; first_block += buffers.size()) {
+      size_t nbatch = std::min(buffers.size(), nblocks - first_block);
+      parallel_for(nbatch, nthreads, [&](size_t b) {
+        buffers[b].clear();
+        format_block(first_block + b, buffers[b]);
+      });
+      for (size_t b=0; b < nbatch; ++b) {
+        out.write(buffers[b].data(), buffers[b].size());
+      }
+    }
+  }
+
+  /* Write rows of numbers as text, one line per row, using the format strings for 'format'.
+   * get(icol, irow) returns the value at column icol of row irow, for irow in [0, nrows);
+   * it must be safe to call concurrently when nthreads != 1.
+   */
+  template <typename Getter>
+  void write_text_rows(std::ostream& out, size_t nrows, size_t ncolumns, Getter get,
+                       const std::string& format, unsigned nthreads=1, int precision=0) {
+    const size_t rows_per_block = 8192;
+    std::array<std::string, 3> formatStrings = get_format_strings(format);
+    size_t nblocks = (nrows + rows_per_block - 1) / rows_per_block;
+
+    write_blocks(out, nblocks, [&](size_t block, std::string& buffer) {
+        size_t row_end = std::min(nrows, (block + 1) * rows_per_block);
+        for (size_t i=block * rows_per_block; i < row_end; ++i) {
+          buffer += formatStrings[0];
+          for (size_t j=0; j < ncolumns - 1; ++j) {
+            append_number(buffer, get(j, i), precision);
+            buffer += formatStrings[1];
+          }
+          append_number(buffer, get(ncolumns - 1, i), precision);  // Don't put a sep character for last column
+          buffer += formatStrings[2];
+          buffer += '\n';
+        }
+      }, nthreads);
+  }
+
+
+  /* Writes blocks of rows to a text file on a background thread.
+   * Rows are passed as flat chunks of 'ncolumns' doubles per row; formatting and I/O
+   * both happen on the writer thread, so the caller only pays for copying the values.
+   * At most 'max_pending' chunks are queued; submit() blocks when the writer falls
+   * further behind, which bounds the memory used.
+   * Used chunk buffers are handed back through get_buffer() to avoid reallocating them.
+   */
+  class ChunkWriter
+  {
+  public:
+    ChunkWriter(const std::string& filename, size_t ncolumns, const std::string& format,
+                size_t max_pending=4, int precision=0);
+    ChunkWriter(const ChunkWriter&) = delete;
+    ~ChunkWriter();
+
+    std::ostream& header() { return outfile; }   // Only use before the first submit()
+    bool is_open() const { return outfile.is_open(); }
+    std::vector<double> get_buffer();
+    void submit(std::vector<double>&& chunk);
+    void wait();    // Block until all submitted chunks are written
+    void close();   // Write remaining chunks, stop the thread and close the file
+
+  private:
+    std::ofstream outfile;
+    size_t ncolumns;
+    std::string format;
+    size_t max_pending;
+    int precision;
+
+    std::deque<std::vector<double> > pending;
+    std::vector<std::vector<double> > spare;
+    size_t writing = 0;       // Number of chunks taken by the thread but not yet written
+    bool stop = false;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::thread thread;
+
+    void run();
+    void write_chunk(const std::vector<double>& chunk);
+  };
+
+  /* Read-only memory mapping of a whole file.
+   * The mapping is released when the object is destroyed, so anything pointing into
+   * data() should hold a (shared) pointer to the MappedFile.
+   * If the file can't be opened or mapped, is_open() returns false.
+   */
+  class MappedFile
+  {
+  public:
+    MappedFile() {}
+    MappedFile(const std::string& filename);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    bool is_open() const { return opened; }
+    const char* data() const { return static_cast<const char*>(address); }
+    size_t size() const { return length; }
+    void close();
+
+  private:
+    bool opened = false;
+    void* address = nullptr;
+    size_t length = 0;
+  };
+
+
+  /* Reader for numeric text tables, such as those written by write_text_rows.
+   * The file is mapped and cut into chunks at line boundaries; chunks are parsed with
+   * std::from_chars on 'nthreads' threads (0: one per core) and handed back in file order.
+   * A line is a data row if, once the line head/tail of 'format' are removed, it consists of
+   * exactly 'ncolumns' numbers separated by the format separator (whitespace around
+   * separators is ignored). Anything else (comments, column labels, org-mode rules) is skipped.
+   */
+  class TextTableReader
+  {
+  public:
+    TextTableReader(const std::string& filename, size_t ncolumns, const std::string& format,
+                    unsigned nthreads=0);
+
+    bool is_open() const { return file.is_open(); }
+    size_t count_lines() const;   // Upper bound on the number of rows, e.g. to reserve memory
+    /* Parse the whole file. consume(values, nrows) is called for each chunk, in order,
+     * with the rows stored contiguously (ncolumns values per row).
+     */
+    void read(const std::function<void(const double*, size_t)>& consume) const;
+
+  private:
+    MappedFile file;
+    size_t ncolumns;
+    std::string head, sep, tail;   // Format strings with surrounding whitespace removed
+    unsigned nthreads;
+
+    std::vector<size_t> chunk_bounds() const;
+    void parse_chunk(const char* begin, const char* end, std::vector<double>& values) const;
+    bool parse_line(const char* begin, const char* end, double* row) const;
+  };
+
+
+  /* Header of the FRANTIC binary format, used by dump_to_binary / read_from_binary.
+   * Layout (native byte order, checked when reading):
+   *   char[8]  magic "FRANTIC"          uint32  version       uint32  kind
+   *   uint64   byte order mark          uint64  ncomponents   uint64  nrows
+   *   uint64   nbins                    double  t0, dt, nSteps
+   *   uint64   number of column names, then for each name: uint64 length + characters
+   *   zero padding up to a multiple of 64 bytes (data_offset)
+   * followed by the data, stored as columns of doubles:
+   *   SERIES     : 1 + ncomponents columns of nrows values; time first
+   *   HISTOGRAMS : the nrows snapshot times, then for each component the number of bins of
+   *                each snapshot's histogram (nrows values), the bin edges (nrows x (nbins+1),
+   *                by snapshot) and the weights (nrows x nbins). nbins is the largest number of
+   *                bins, since histograms extend to take in outliers; the records of histograms
+   *                with fewer bins are padded (edges with NaN, weights with 0).
+   * Because the data is aligned and uncompressed, a mapped file can be used directly.
+   */
+  struct BinaryHeader
+  {
+    enum Kind : uint32_t { NONE = 0, SERIES = 1, HISTOGRAMS = 2 };
+    static constexpr uint32_t version = 2;
+
+    Kind kind = NONE;
+    uint64_t ncomponents = 0;   // Size of XVector
+    uint64_t nrows = 0;         // Number of rows (series) or snapshots (histograms)
+    uint64_t nbins = 0;         // Largest number of bins of a histogram; 0 for series
+    double t0 = 0, dt = 0, nSteps = 0;
+    std::vector<std::string> column_names;
+    size_t data_offset = 0;     // Set by write() and read()
+
+    void write(std::ostream& out);
+    static BinaryHeader read(const char* data, size_t size);  // Throws std::runtime_error if invalid
+    size_t data_size() const;   // Number of data bytes expected after the header
+  };
+
   /* \todo: Make all but value a template parameter ?
    *        Would allow to define in typedef, shortening construction statement
    * \todo: Following above, overload tuple construction to allow specifying only values
@@ -42,10 +256,11 @@ namespace frantic
     Parameter(const Parameter<T>& source) = delete;   // Probably shouldn't copy parameters
     Parameter(const Parameter<T>&& source)
       : key(std::move(source.key)), display_str(std::move(source.display_str)),
-        value(std::move(source.value)), modifiable(std::move(modifiable)) {}
+        value(std::move(source.value)), modifiable(source.modifiable) {}
 
     Parameter& operator= (const T new_value) {
       value = new_value;
+      return *this;
     }
 
     // virtual because derived classes might need to overload
@@ -70,7 +285,7 @@ namespace frantic
     // Otherwise, we create an instance of the variable, because it has to stay
     // persistent for the life of the parameter tuple
     typename std::conditional<store_internally, Param, Param&>::type param;
-    ParameterTuple<Params...> params;
+    ParameterTuple<store_internally, Params...> params;
 
   public:
     const bool empty = false;
@@ -90,7 +305,7 @@ namespace frantic
       if (param.key == key) {
         return param.value;
       } else if (!params.empty){
-        return params.get(key);
+        return params.template get<T>(key);
       } else {
         std::cerr << "No parameter has key " << key;
         assert(false);
@@ -103,11 +318,10 @@ namespace frantic
       if (param.key == key) {
         param = new_value;
       } else if (!params.empty){
-        return params.update(key);
+        params.update(key, new_value);
       } else {
         std::cerr << "No parameter has key " << key;
         assert(false);
-        return 0;
       }
     }
 
@@ -136,6 +350,12 @@ namespace frantic
   template <bool store_internally>
   struct ParameterTuple<store_internally> {
     const bool empty = true;
+
+    template <typename T>
+    T get(const std::string&) {assert(false); return T();} // Should never execute
+    template <typename T>
+    void update(const std::string&, const T) {assert(false);} // ditto
+    void print() {return;}
   };
 
 }
@@ -0,0 +1,76 @@
+#ifndef MILSTEIN_STTIC_H
+#define MILSTEIN_STTIC_H
+
+#include <cmath>
+
+#include "integrator.h"
+#include "stochastic.h"
+
+using std::vector;
+
+namespace integrators {
+
+  /* Milstein integrator for stochastic differential equations (strong order: 1, weak order: 1),
+   * in its derivative-free (stochastic Runge-Kutta) form: the derivatives of the diffusion
+   * coefficients in the Milstein term are replaced by differences of the coefficients at
+   * the supporting values x + drift*dt + g_j*sqrt(dt), one per noise source (Kloeden & Platen,
+   * "Numerical Solution of Stochastic Differential Equations", 11.1).
+   * Uses the same drift / diffusion_coeffs / diffusion_differentials interface as
+   * Euler_sttic. The noise sources should be commutative (e.g. a single source, or
+   * coefficients which only depend on t); otherwise the Levy areas are neglected and the
+   * strong order drops to 1/2.
+   * A step costs one drift and 1 + (number of noise sources) diffusion evaluations. With
+   * additive noise the Milstein term vanishes and the scheme is Euler-Maruyama (which then
+   * has strong order 1): use SRA_sttic for that case.
+   */
+  template <class Differential>
+  class Milstein_sttic : public frantic::Integrator<Differential>
+  {
+  private:
+    using XVector = typename Differential::XVector;
+
+  public:
+
+    using frantic::Integrator<Differential>::Integrator;  // Allow parent class overloads
+    Milstein_sttic<Differential>() : frantic::Integrator<Differential>() {
+      this->order = 1;
+    }
+    virtual ~Milstein_sttic() {}
+
+    /* Given a total derivative functor dX, integrate the DE problem. */
+    void integrate(const Differential& dX) {
+      auto& history = this->history;
+
+      assert(history.check_initialized());
+
+      const double dt = history.dt;
+      const double sqrt_dt = std::sqrt(dt);
+      double t = history.t0;
+      XVector x = history(t);
+
+      for (ptrdiff_t i=0; i < history.nSteps; ++i) {   // nSteps is the number of steps from t0 to tn
+        const XVector x_drift = x + dX.drift(t, x, history) * dt;
+        const auto g = dX.diffusion_coeffs(t, x, history);
+        const auto dW = dX.diffusion_differentials(dt);
+        XVector x_next = x_drift + g.sum_products(dW);
+
+        // Milstein term: sum_j sum_k (L^j g_k) I_jk, with commutative noise I_jk + I_kj = dW_j dW_k
+        constexpr int nsources = std::decay_t<decltype(g)>::size;
+        frantic::unroll<nsources>([&](auto j) {
+          constexpr size_t jj = decltype(j)::value;
+          const auto dg = dX.diffusion_coeffs(t, XVector(x_drift + g.template get<jj>() * sqrt_dt), history) - g;
+          x_next += (frantic::noise_product(XVector(dg.sum_products(dW)), dW.template get<jj>())
+                     - dg.template get<jj>() * dt) / (2 * sqrt_dt);
+        });
+
+        x = x_next;
+        t += dt;
+        history.update(t, x);
+      }
+    }
+
+  };
+
+}
+
+#endif // MILSTEIN_STTIC_H
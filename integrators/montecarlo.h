@@ -0,0 +1,120 @@
+/* Monte Carlo driver: independent realizations of a stochastic simulation, run on several
+ * threads, and the combination of their results.
+ */
+
+#ifndef MONTECARLO_H
+#define MONTECARLO_H
+
+#include <assert.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "parallel.h"
+
+namespace frantic {
+
+  /* Seed of run 'i': the i-th output of the splitmix64 generator started at 'seed'.
+   * Consecutive seeds are thus decorrelated, even for consecutive values of 'seed'. */
+  inline std::uint64_t run_seed(std::uint64_t seed, size_t i) {
+    std::uint64_t z = seed + (std::uint64_t(i) + 1) * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  }
+
+  /* Runs realizations of a simulation, spread over 'nthreads' threads (0: one per core).
+   * Each thread (worker) owns a Simulation, built by the factory on its first run and kept
+   * for the following ones: its integrator, history, noise and accumulated results (e.g. a
+   * ProbabilityDensity filled as the history is updated) are never shared, so need no locking.
+   * The factory is called from the worker threads, and must not modify shared state.
+   * Each run is given a seed, computed from the index of the run and the driver's seed, with
+   * which the run function should seed the simulation's noise (GaussianWhiteNoise::seed).
+   * Since it doesn't depend on which worker does the run, results are the same for any number
+   * of threads, up to the order in which they are summed.
+   * Once run() returns, merge() combines the results of the workers; these must provide
+   * merge(const Result&), as HistCollection (thus ProbabilityDensity) and RunningStatistics do.
+   * Example, with a simulation whose history accumulates a ProbabilityDensity:
+   *   frantic::MonteCarlo<Sim> mc([](unsigned) { return std::make_unique<Sim>(); });
+   *   mc.run(1000, [](Sim& sim, size_t, std::uint64_t seed) {
+   *       sim.dX.noise.seed(seed);
+   *       sim.run_loop();
+   *     });
+   *   auto density = mc.merge([](const Sim& sim) -> const HistCollection<XVector>& {
+   *       return sim.integrator.history; });
+   */
+  template <class Simulation>
+  class MonteCarlo
+  {
+  public:
+    using Factory = std::function<std::unique_ptr<Simulation>(unsigned worker)>;
+    using Run = std::function<void(Simulation& sim, size_t run, std::uint64_t seed)>;
+
+    MonteCarlo(Factory factory, unsigned nthreads = 0, std::uint64_t seed = 0)
+      : factory(std::move(factory)), nthreads(nthreads), seed(seed) {}
+
+    void set_nthreads(unsigned n) { nthreads = n; }
+    void set_seed(std::uint64_t s) { seed = s; }
+
+    std::uint64_t run_seed(size_t i) const { return frantic::run_seed(seed, i); }
+
+    /* Do 'nruns' more runs, calling run_once(sim, i, run_seed(i)) for each. Runs are numbered
+     * from the number already done, so that calling run() again continues with new seeds.
+     * The first exception thrown by a run is rethrown once the threads have finished. */
+    void run(size_t nruns, const Run& run_once) {
+      unsigned n = effective_nthreads(nruns, nthreads);
+      if (workers.size() < n) workers.resize(n);   // Not from within the threads
+      const size_t first = nruns_done;
+      parallel_for_workers(nruns, n, [&](unsigned worker, size_t i) {
+          std::unique_ptr<Simulation>& sim = workers[worker];
+          if (!sim) {
+            sim = factory(worker);
+            assert(sim);
+          }
+          run_once(*sim, first + i, run_seed(first + i));
+        });
+      nruns_done += nruns;
+    }
+
+    /* Combine the results of the workers: 'get' returns the result of a simulation (e.g. a
+     * reference to its density), and the copy of the first worker's result is merged with the
+     * others'. Must not be called before a run. */
+    template <typename Get>
+    auto merge(Get get) const -> std::decay_t<decltype(get(std::declval<const Simulation&>()))> {
+      using Result = std::decay_t<decltype(get(std::declval<const Simulation&>()))>;
+      auto first = std::find_if(workers.begin(), workers.end(),
+                                [](const std::unique_ptr<Simulation>& sim) { return bool(sim); });
+      assert(first != workers.end());
+      Result result = get(**first);
+      for (auto it = first + 1; it != workers.end(); ++it) {
+        if (*it) result.merge(get(**it));
+      }
+      return result;
+    }
+
+    size_t get_nruns() const { return nruns_done; }
+    size_t get_nworkers() const { return workers.size(); }
+    /* Simulation of worker k; null if that worker hasn't done any run */
+    Simulation* get_worker(size_t k) { return workers.at(k).get(); }
+    /* Discard the simulations, and restart the numbering of runs (thus the seeds) */
+    void reset() {
+      workers.clear();
+      nruns_done = 0;
+    }
+
+  private:
+    Factory factory;
+    unsigned nthreads;
+    std::uint64_t seed;
+    size_t nruns_done = 0;
+    std::vector<std::unique_ptr<Simulation> > workers;
+  };
+
+} // End namespace frantic
+
+#endif // MONTECARLO_H
@@ -0,0 +1,82 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <vector>
+
+namespace frantic {
+
+  /* Number of threads to use when the caller asks for 0 (i.e. "as many as useful") */
+  inline unsigned default_nthreads() {
+    unsigned n = std::thread::hardware_concurrency();
+    return (n == 0) ? 1 : n;
+  }
+
+  /* Number of threads parallel_for actually uses for n indices */
+  inline unsigned effective_nthreads(size_t n, unsigned nthreads) {
+    if (nthreads == 0) nthreads = default_nthreads();
+    return static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(nthreads, n)));
+  }
+
+  /* Same as parallel_for, calling f(worker, i) where 'worker' identifies the thread running
+   * it, in [0, effective_nthreads(n, nthreads)); the calling thread is worker 0. This allows
+   * per-thread state (e.g. one simulation per thread) without locking.
+   */
+  template <typename F>
+  void parallel_for_workers(size_t n, unsigned nthreads, F&& f) {
+    nthreads = effective_nthreads(n, nthreads);
+    if (nthreads <= 1) {
+      for (size_t i=0; i < n; ++i) {
+        f(0u, i);
+      }
+      return;
+    }
+
+    std::atomic<size_t> next(0);
+    std::exception_ptr error;
+    std::atomic_flag error_set = ATOMIC_FLAG_INIT;
+    auto work = [&](unsigned worker) {
+      try {
+        for (size_t i = next++; i < n; i = next++) {
+          f(worker, i);
+        }
+      } catch (...) {
+        if (!error_set.test_and_set()) {
+          error = std::current_exception();
+        }
+        next = n;   // Stop handing out work
+      }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned k=1; k < nthreads; ++k) {
+      threads.emplace_back(work, k);
+    }
+    work(0);
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+  /* Call f(i) for every i in [0, n), distributing the indices over 'nthreads' threads
+   * (the calling thread being one of them). Indices are handed out one at a time, so
+   * uneven work per index is balanced automatically; f should therefore work on chunks
+   * large enough to make this overhead negligible.
+   * With nthreads == 1 (or n == 1) everything runs on the calling thread, in order.
+   * The first exception thrown by f is rethrown once all threads have finished.
+   */
+  template <typename F>
+  void parallel_for(size_t n, unsigned nthreads, F&& f) {
+    parallel_for_workers(n, nthreads, [&f](unsigned, size_t i) { f(i); });
+  }
+
+} // End namespace frantic
+
+#endif // PARALLEL_H
@@ -45,18 +45,17 @@
  */
 
 
+
 #ifndef RKF45_GSL_H
 #define RKF45_GSL_H
 
-#include "integrator.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string>
 
-//#include <o2scl/test_mgr.h>
-//#include <o2scl/ode_funct.h>
-//#include <o2scl/ode_rkf45_gsl.h>
-//#include <o2scl/table.h>
-//#include <o2scl/ode_iv_integrate.h>
-//#include <o2scl/hdf_file.h>
-//#include <o2scl/hdf_io.h>
+#include "integrator.h"
 
 using std::vector;
 
@@ -64,182 +63,225 @@ namespace integrators {
 
 
   /* A Runge-Kutta 4-5 embedded integrator (4th order integration, 5-th order error)
-   * The required signature for the update function is
-   * void update(double t, double x, double xerr)
-   * where t is current time, x current state, and xerr the estimated step error
+   * with adaptive step size, for delayed (or ordinary) differential equations.
+   * Same interface as Euler_sttic, with the derivative given by dX.drift(t, x, history)
+   * and the history an InterpolatedSeries (or a class deriving from it).
+   *
+   * A step is accepted if, for every component, the estimated error is below
+   * abs_tol + rel_tol * |x|; the next step is then scaled by 0.9 * err^(-1/5), and a rejected
+   * step retried with 0.9 * err^(-1/4) (factors limited to [0.2, 5]).
+   * The step given to the history's set_range is the first one tried; rows are added as steps
+   * are accepted, so they are not uniformly spaced (see InterpolatedSeries::resample).
+   * Steps are truncated to end exactly on the critical points of the history and on tn, so
+   * that no step straddles a discontinuity of the solution's derivatives (see frantic::StepControl).
+   * When a step is longer than the shortest delay, its stages look up the solution within the
+   * step itself: the step is then iterated on a provisional row at its end (see
+   * InterpolatedSeries::add_provisional_row), rolled back each time, until the end state
+   * converges; otherwise the step is rejected. The error of such steps also includes an
+   * estimate of that of the lookups within the step.
+   * If the history accepts dense output, the derivative at the end of each step (which the
+   * method computes anyway for the next step) is recorded with it.
    */
   template <class Differential>
   class RKF45_gsl : public frantic::Integrator<Differential>
   {
   private:
-    //	  ODETypes::NOISE_SHAPE noiseShape = ODETypes::NOISE_NONE;
-
     using XVector = typename Differential::XVector;
 
-    // required because this is a template function
-    using frantic::Integrator<Differential>::history;
-    using frantic::Integrator<Differential>::tBegin;
-    using frantic::Integrator<Differential>::tEnd;
-    using frantic::Integrator<Differential>::dt;  // stepsize
-    using frantic::Integrator<Differential>::nSteps;
-    using frantic::Integrator<Differential>::ode;
-
-    Differential& dX;
-
   public:
-    //	  int order = 5;
 
-    // Constructor below
+    using frantic::Integrator<Differential>::Integrator;  // Allow parent class overloads
+    RKF45_gsl<Differential>() : frantic::Integrator<Differential>() {
+      this->order = 4;
+    }
     virtual ~RKF45_gsl() {}
 
-    void integrate(typename Differential::ParamType parameters) {
-      double t;
-      XVector x, dx, xout, dx_out;
-      XVector xerr;
-
-      //o2scl::test_mgr test_mgr;
-      //test_mgr.set_output_level(1);
-
-      assert(history.check_initialized());
-
-      dX.setParameters(parameters);
-
-      t = history.t0;
-      x = history(t);
-      dx = dX.f(t, x);
-      //history.update(t,x, XVector::Constant(0));
+    void set_tolerances(double absolute, double relative) {
+      assert(absolute >= 0 and relative >= 0 and absolute + relative > 0);
+      abs_tol = absolute;
+      rel_tol = relative;
+    }
+    /* See frantic::StepControl */
+    void set_step_limits(double min, double max) { step_control.set_limits(min, max); }
+    size_t get_naccepted() const { return naccepted; }
+    size_t get_nrejected() const { return nrejected; }
 
-      while (history.after_end(t)) {
-        step(t, x, dx, x, xerr, dx);
-        t += dt;
-        history.update(t, x, xerr);
-      }
+    void integrate(const Differential& dX);
 
+  protected:
+    double abs_tol = 1e-6;
+    double rel_tol = 1e-6;
+    frantic::StepControl step_control;
+    int max_iterations = 8;      // Iterations on the provisional row, for steps longer than a delay
+    size_t naccepted = 0;
+    size_t nrejected = 0;
+
+    double attempt(const Differential& dX, double t, double h, const XVector& x, const XVector& dxdt,
+                   XVector& xout, XVector& dxdt_out);
+    double error_norm(const XVector& err, const XVector& x, const XVector& xout) const {
+      return (err.array().abs() / (abs_tol + rel_tol * x.array().abs().max(xout.array().abs()))).maxCoeff();
     }
 
     //----------------------------------------------------
     // code ported from o2scl/ode_rkf45_gsl.h starts here
     //----------------------------------------------------
-  protected:
 
     /// \name Storage for the intermediate steps
     //@{
     XVector k2, k3, k4, k5, k6;
     XVector xtmp;
-    //@}hout return
-
+    //@}
 
-    /** \name Storage for the coefficients
+    /** \name Coefficients
      */
     //@{
-    Eigen::Matrix<double, 5, 1> ah;
-    Eigen::Vector2d b3;
-    Eigen::Vector3d b4;
-    Eigen::Vector4d b5;
-    Eigen::Matrix<double, 5, 1> b6;
-    double c1, c3, c4, c5, c6;
-    Eigen::Matrix<double, 7, 1> ec;
+    static constexpr double ah[5] = {1.0/4.0, 3.0/8.0, 12.0/13.0, 1.0, 1.0/2.0};
+    static constexpr double b3[2] = {3.0/32.0, 9.0/32.0};
+    static constexpr double b4[3] = {1932.0/2197.0, -7200.0/2197.0, 7296.0/2197.0};
+    static constexpr double b5[4] = {8341.0/4104.0, -32832.0/4104.0, 29440.0/4104.0, -845.0/4104.0};
+    static constexpr double b6[5] = {-6080.0/20520.0, 41040.0/20520.0, -28352.0/20520.0, 9295.0/20520.0, -5643.0/20520.0};
+    static constexpr double c1 = 902880.0/7618050.0;
+    static constexpr double c3 = 3953664.0/7618050.0;
+    static constexpr double c4 = 3855735.0/7618050.0;
+    static constexpr double c5 = -1371249.0/7618050.0;
+    static constexpr double c6 = 277020.0/7618050.0;
+    static constexpr double ec[7] = {0.0, 1.0/360.0, 0.0, -128.0/4275.0, -2197.0/75240.0, 1.0/50.0, 2.0/55.0};
     //@}
 
-  public:
-
-    RKF45_gsl<Differential>(Differential& dX) : dX(dX) {
-      this->order=4;
-
-      ah << 1.0/4.0, 3.0/8.0, 12.0/13.0, 1.0, 1.0/2.0;
-      b3 << 3.0/32.0, 9.0/32.0;
-      b4 << 1932.0/2197.0, -7200.0/2197.0, 7296.0/2197.0;
-      b5 << 8341.0/4104.0, -32832.0/4104.0, 29440.0/4104.0, -845.0/4104.0;
-      b6 << -6080.0/20520.0, 41040.0/20520.0, -28352.0/20520.0, 9295.0/20520.0, -5643.0/20520.0;
-
-      c1=902880.0/7618050.0;
-      c3=3953664.0/7618050.0;
-      c4=3855735.0/7618050.0;
-      c5=-1371249.0/7618050.0;
-      c6=277020.0/7618050.0;
-
-      ec << 0.0, 1.0/360.0, 0.0, -128.0/4275.0, -2197.0/75240.0, 1.0/50.0, 2.0/55.0;
-
-    }
-
-  protected:
     /** \brief Perform an integration step
 
       Given initial value of the n-dimensional function in \c x and
       the derivative in \c dxdt (which must be computed beforehand) at
       the point \c x, take a step of size \c h giving the result in \c
       xout, the uncertainty in \c xerr, and the new derivative in \c
-      dxdt_out using function \c derivs to calculate derivatives. The
-      parameters \c xout and \c x and the parameters \c dxdt_out and
-      \c dxdt may refer to the same object.
-
-      If \c derivs always returns zero, then this function will
-      also return zero. If not, <tt>step()</tt> will return the first
-      non-zero value which was obtained in a call to \c derivs .
-      The error handler is never called.
-
-      \todo: use standard std::vector for xerr to avoid overhead ?
-      \todo: implement error checking (removed o2scl mechanism)
+      dxdt_out. The parameters \c xout and \c x and the parameters
+      \c dxdt_out and \c dxdt may not refer to the same object.
     */
-    void step(double t, XVector &x, XVector &dxdt,
-              XVector &xout, XVector &xerr, XVector &dxdt_out) {
-
-      int ret=0;
-      size_t i;
-
-      //bool printout = true;
-      //if (printout) std::cout << dxdt[0] << ", " << dxdt[1] << std::endl;
+    void step(const Differential& dX, double t, double h, const XVector& x, const XVector& dxdt,
+              XVector& xout, XVector& xerr, XVector& dxdt_out) {
+      auto& history = this->history;
 
       // k1 step
-      xtmp = x + dt * ah(0) * dxdt;
-      //if (printout) std::cout << "k1: " << xtmp[0] << ", " << xtmp[1] << std::endl;
+      xtmp = x + h * ah[0] * dxdt;
 
       // k2 step
-      k2 = dX.f(t + ah[0]*dt, xtmp, history);
-      xtmp = x + dt * (b3(0) * dxdt + b3(1) * k2);
-      //if (printout) std::cout << "k2: " << xtmp[0] << ", " << xtmp[1] << std::endl;lastmod{1388808352000}; mode{1}; location{[BaseFolder]/Shampine_2005_Error Estimation and Control for ODEs.pdf}; projectFolder{}
+      k2 = dX.drift(t + ah[0]*h, xtmp, history);
+      xtmp = x + h * (b3[0] * dxdt + b3[1] * k2);
 
       // k3 step
-      k3 = dX.f(t + ah[1]*dt, xtmp, history);
-      xtmp = x + dt * (b4(0) * dxdt + b4(1) * k2 + b4(2) * k3);
-      //if (printout) std::cout << "k3: " << xtmp[0] << ", " << xtmp[1] << std::endl;
+      k3 = dX.drift(t + ah[1]*h, xtmp, history);
+      xtmp = x + h * (b4[0] * dxdt + b4[1] * k2 + b4[2] * k3);
 
       // k4 step
-      k4 = dX.f(t + ah[2]*dt, xtmp, history);
-      xtmp = x + dt * (b5(0) * dxdt + b5(1) * k2 + b5(2) * k3
-                       + b5(3) * k4);
-      //if (printout) std::cout << "k4: " << xtmp[0] << ", " << xtmp[1] << std::endl;
+      k4 = dX.drift(t + ah[2]*h, xtmp, history);
+      xtmp = x + h * (b5[0] * dxdt + b5[1] * k2 + b5[2] * k3
+                      + b5[3] * k4);
 
       // k5 step
-      k5 = dX.f(t + ah[3]*dt, xtmp, history;
-      xtmp = x + dt * (b6(0) * dxdt + b6(1) * k2 + b6(2) * k3
-                       + b6(3) * k4 + b6(4) * k5);
-      //if (printout) std::cout << "k5: " << xtmp[0] << ", " << xtmp[1] << std::endl;
+      k5 = dX.drift(t + ah[3]*h, xtmp, history);
+      xtmp = x + h * (b6[0] * dxdt + b6[1] * k2 + b6[2] * k3
+                      + b6[3] * k4 + b6[4] * k5);
 
       // k6 step and final sum
-      k6 = dX.f(t + ah[4]*dt, xtmp, history);
-      xout = x + dt * (c1 * dxdt + c3 * k3 + c4 * k4
-                       + c5 * k5 + c6 * k6);
-      //if (printout) std::cout << "k6: " << xout[0] << ", " << xout[1] << std::endl;
-
-      // We put this before the last function evaluation, in contrast
-      // to the GSL version, so that the dxdt that appears
-      // below isn't modified by the subsequent derivative
-      // evaluation using dxdt_out. (The user could have given the
-      // same vector for both)
-      xerr = dt * (ec(1) * dxdt + ec(3) * k3 + ec(4) * k4
-                   + ec(5) * k5 + ec(6) * k6);
-      //if (printout) std::cout << "k1: " << xerr[0] << ", " << xerr[1] << std::endl;
+      k6 = dX.drift(t + ah[4]*h, xtmp, history);
+      xout = x + h * (c1 * dxdt + c3 * k3 + c4 * k4
+                      + c5 * k5 + c6 * k6);
 
+      xerr = h * (ec[1] * dxdt + ec[3] * k3 + ec[4] * k4
+                  + ec[5] * k5 + ec[6] * k6);
 
-      dxdt_out = dX.f(t + dt, xout, history);
+      dxdt_out = dX.drift(t + h, xout, history);
+    }
 
-      //if (printout) assert(false);
+  };
 
+  /* Compute a step of length h from (t, x), returning the scaled error estimate
+   * (error_norm: accept if <= 1), or infinity if the iteration on the provisional row
+   * did not converge.
+   */
+  template <class Differential>
+  double RKF45_gsl<Differential>::attempt(const Differential& dX, double t, double h, const XVector& x, const XVector& dxdt,
+                                          XVector& xout, XVector& dxdt_out) {
+    auto& history = this->history;
+    XVector xerr;
+
+    if (h <= history.get_min_delay()) {
+      // All the lookups are before t
+      step(dX, t, h, x, dxdt, xout, xerr, dxdt_out);
+      return error_norm(xerr, x, xout);
     }
 
+    const size_t nlines = history.get_nlines();
+    XVector guess = x + h * dxdt;     // Euler estimate of the end of the step
+    XVector guess_dxdt = dxdt;
+    for (int iteration=0; iteration < max_iterations; ++iteration) {
+      history.add_provisional_row(t + h, guess, guess_dxdt);
+      step(dX, t, h, x, dxdt, xout, xerr, dxdt_out);
+      history.rollback(nlines);
+      double change = error_norm(xout - guess, x, xout);
+      guess = xout;
+      guess_dxdt = dxdt_out;
+      if (change <= 0.1) {   // Converged to well within the tolerance
+        // The error estimate of the method doesn't include that of the lookups within the step,
+        // made on the Hermite interpolant through both ends: estimate it from the defect of that
+        // interpolant (how far it is from solving the equation). Its derivative error vanishes at
+        // the middle of the step, so sample a quarter from each end instead.
+        history.add_provisional_row(t + h, xout, dxdt_out);
+        double defect_err = 0;
+        for (double theta : {0.25, 0.75}) {
+          double dh00 = 6 * theta * (theta - 1);
+          XVector xq = (2*theta*theta*theta - 3*theta*theta + 1) * x + (3 - 2*theta) * theta*theta * xout
+                       + h * theta * (theta - 1) * ((theta - 1) * dxdt + theta * dxdt_out);
+          XVector dxdt_q = dh00 * (x - xout) / h + (3*theta*theta - 4*theta + 1) * dxdt
+                           + (3*theta*theta - 2*theta) * dxdt_out;
+          defect_err = std::max(defect_err,
+                                error_norm(h * (dX.drift(t + theta * h, xq, history) - dxdt_q), x, xout));
+        }
+        history.rollback(nlines);
+        return std::max(error_norm(xerr, x, xout), defect_err);
+      }
+    }
+    return std::numeric_limits<double>::infinity();
+  }
 
-  };
+  template <class Differential>
+  void RKF45_gsl<Differential>::integrate(const Differential& dX) {
+    auto& history = this->history;
+
+    assert(history.check_initialized());
+    assert(history.t0 < history.tn);   // Only forward integration is implemented
+
+    double t = history.t0;
+    XVector x = history(t);
+    XVector dxdt = dX.drift(t, x, history);
+    this->record_initial_slope(dxdt);
+
+    XVector xout, dxdt_out;
+    double h = std::min(std::abs(history.dt), step_control.hmax);
+    naccepted = 0;
+    nrejected = 0;
+
+    while (t < history.tn) {
+      const double h_try = step_control.truncate(history, t, h);
+      step_control.check_min("RKF45", t, h);
+
+      double err = attempt(dX, t, h_try, x, dxdt, xout, dxdt_out);
+      if (err <= 1) {
+        t = step_control.end(t);
+        x = xout;
+        dxdt = dxdt_out;
+        this->record_step(t, x, dxdt);
+        ++naccepted;
+        double factor = (err == 0) ? 5 : std::min(5.0, std::max(0.2, 0.9 * std::pow(err, -0.2)));
+        double h_next = step_control.is_truncated() ? std::max(h, factor * h_try) : factor * h_try;
+        h = std::min(step_control.hmax, h_next);
+      } else {
+        ++nrejected;
+        double factor = std::isinf(err) ? 0.5 : std::max(0.2, 0.9 * std::pow(err, -0.25));
+        h = factor * h_try;
+      }
+    }
+  }
 }
 
 #endif // RKF45_GSL_H
@@ -0,0 +1,179 @@
+#ifndef ROSENBROCK_H
+#define ROSENBROCK_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include "integrator.h"
+#include "implicit.h"
+
+using std::vector;
+
+namespace integrators {
+
+
+  /* Linearly implicit Rosenbrock 2(3) integrator with adaptive step size, for stiff delayed
+   * (or ordinary) differential equations: the formula of Shampine & Reichelt, "The MATLAB ODE
+   * suite", SIAM J. Sci. Comput. 18 (1997) (ode23s). Second order and L-stable, with a third
+   * order error estimate. Same interface as RKF45_gsl.
+   *
+   * Each step solves three linear systems with the matrix I - h*d*J, with J the Jacobian of
+   * the drift (see frantic::Linearization: Differential::jacobian if provided, else finite
+   * differences). The formula is a W-method, i.e. keeps its order with an approximate J, so
+   * the Jacobian is kept across steps and only recomputed after a rejected step or every
+   * 'jacobian_age' accepted steps, and the step size is kept unchanged when the controller
+   * would only increase it slightly, so that the LU factorization is reused as well.
+   * The time derivative of the drift is not covered by that property, and is recomputed (by
+   * a forward difference) at the start of every step.
+   * The last drift evaluation of a step is the first of the next one, and is recorded with
+   * the step as dense output.
+   * Steps end exactly on the critical points of the history and on tn, and are never longer
+   * than the shortest delay (the stages would otherwise need the solution within the step).
+   */
+  template <class Differential>
+  class Rosenbrock23 : public frantic::Integrator<Differential>
+  {
+  private:
+    using XVector = typename Differential::XVector;
+
+  public:
+
+    using frantic::Integrator<Differential>::Integrator;  // Allow parent class overloads
+    Rosenbrock23<Differential>() : frantic::Integrator<Differential>() {
+      this->order = 2;
+    }
+    virtual ~Rosenbrock23() {}
+
+    void set_tolerances(double absolute, double relative) {
+      assert(absolute >= 0 and relative >= 0 and absolute + relative > 0);
+      abs_tol = absolute;
+      rel_tol = relative;
+    }
+    /* See frantic::StepControl */
+    void set_step_limits(double min, double max) { step_control.set_limits(min, max); }
+    /* Recompute the Jacobian at least every 'nsteps' accepted steps */
+    void set_jacobian_age(size_t nsteps) {
+      assert(nsteps > 0);
+      jacobian_age = nsteps;
+    }
+    size_t get_naccepted() const { return naccepted; }
+    size_t get_nrejected() const { return nrejected; }
+    const frantic::Linearization<Differential>& get_linearization() const { return linearization; }
+
+    void integrate(const Differential& dX);
+
+  protected:
+    double abs_tol = 1e-6;
+    double rel_tol = 1e-6;
+    frantic::StepControl step_control;
+    size_t jacobian_age = 20;
+    size_t naccepted = 0;
+    size_t nrejected = 0;
+
+    frantic::Linearization<Differential> linearization;
+    XVector dfdt;                 // Partial derivative of the drift with respect to t
+
+    static constexpr double d = 0.29289321881345248;     // 1 / (2 + sqrt(2))
+    static constexpr double e32 = 7.4142135623730950;    // 6 + sqrt(2)
+
+    double error_norm(const XVector& err, const XVector& x, const XVector& xout) const {
+      return (err.array().abs() / (abs_tol + rel_tol * x.array().abs().max(xout.array().abs()))).maxCoeff();
+    }
+    void update_time_derivative(const Differential& dX, double t, const XVector& x, const XVector& dxdt, double h);
+    double step(const Differential& dX, double t, double h, const XVector& x, const XVector& dxdt,
+                XVector& xout, XVector& dxdt_out);
+  };
+
+  /* Partial derivative of the drift with respect to t at (t, x) */
+  template <class Differential>
+  void Rosenbrock23<Differential>::update_time_derivative(const Differential& dX, double t, const XVector& x,
+                                                          const XVector& dxdt, double h) {
+    // Forward difference: steps start on critical points, where the drift may have a kink in t
+    double delta = std::sqrt(std::numeric_limits<double>::epsilon()) * std::max(std::abs(t), h);
+    dfdt = (dX.drift(t + delta, x, this->history) - dxdt) / delta;
+  }
+
+  /* Compute a step of length h from (t, x), returning the scaled error estimate
+   * (error_norm: accept if <= 1).
+   */
+  template <class Differential>
+  double Rosenbrock23<Differential>::step(const Differential& dX, double t, double h, const XVector& x,
+                                          const XVector& dxdt, XVector& xout, XVector& dxdt_out) {
+    auto& history = this->history;
+
+    linearization.factorize(h * d);
+    const XVector k1 = linearization.solve(dxdt + (h * d) * dfdt);
+    const XVector f1 = dX.drift(t + 0.5 * h, x + (0.5 * h) * k1, history);
+    const XVector k2 = linearization.solve(f1 - k1) + k1;
+    xout = x + h * k2;
+    dxdt_out = dX.drift(t + h, xout, history);
+    const XVector k3 = linearization.solve(dxdt_out - e32 * (k2 - f1) - 2.0 * (k1 - dxdt) + (h * d) * dfdt);
+    return error_norm((h / 6.0) * (k1 - 2.0 * k2 + k3), x, xout);
+  }
+
+  template <class Differential>
+  void Rosenbrock23<Differential>::integrate(const Differential& dX) {
+    auto& history = this->history;
+
+    assert(history.check_initialized());
+    assert(history.t0 < history.tn);   // Only forward integration is implemented
+
+    double t = history.t0;
+    XVector x = history(t);
+    XVector dxdt = dX.drift(t, x, history);
+    this->record_initial_slope(dxdt);
+
+    const double h_limit = std::min(step_control.hmax, history.get_min_delay());
+    XVector xout, dxdt_out;
+    double h = std::min(std::abs(history.dt), h_limit);
+    naccepted = 0;
+    nrejected = 0;
+    linearization.reset();
+    linearization.update_jacobian(dX, t, x, dxdt, history);
+    update_time_derivative(dX, t, x, dxdt, h);
+    size_t steps_since_jacobian = 0;
+    bool fresh_jacobian = true;         // Computed at the current (t, x)
+
+    while (t < history.tn) {
+      const double h_try = step_control.truncate(history, t, h);
+      step_control.check_min("Rosenbrock23", t, h);
+
+      double err = step(dX, t, h_try, x, dxdt, xout, dxdt_out);
+      if (err <= 1) {
+        t = step_control.end(t);
+        x = xout;
+        dxdt = dxdt_out;
+        this->record_step(t, x, dxdt);
+        ++naccepted;
+        fresh_jacobian = false;
+        if (++steps_since_jacobian >= jacobian_age) {
+          linearization.update_jacobian(dX, t, x, dxdt, history);
+          steps_since_jacobian = 0;
+          fresh_jacobian = true;
+        }
+        update_time_derivative(dX, t, x, dxdt, h);
+        double factor = (err == 0) ? 5 : std::min(5.0, std::max(0.2, 0.9 * std::pow(err, -1.0/3.0)));
+        if (step_control.is_truncated()) {
+          factor = std::max(1.0, factor * h_try / h);
+        }
+        if (factor > 1.2) {          // Otherwise keep the step, and the factorization
+          h = std::min(h_limit, factor * h);
+        }
+      } else {
+        ++nrejected;
+        if (!fresh_jacobian) {
+          // The step may have failed because of an outdated Jacobian
+          linearization.update_jacobian(dX, t, x, dxdt, history);
+          steps_since_jacobian = 0;
+          fresh_jacobian = true;
+        }
+        h = std::max(0.2, 0.9 * std::pow(err, -1.0/3.0)) * h_try;
+      }
+    }
+  }
+}
+
+#endif // ROSENBROCK_H
@@ -0,0 +1,197 @@
+#ifndef SINKS_H
+#define SINKS_H
+
+#include <assert.h>
+#include <cmath>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "io.h"
+
+namespace frantic {
+
+  /* Interface for objects receiving the rows of a Series as they are recorded.
+   * Sinks are attached with Series::add_sink(); each row passed to the series' storage by
+   * update() (i.e. after decimation) is also passed to write(). This allows results to leave
+   * memory during the integration, so that the series itself only needs to retain what is
+   * still required for interpolation (e.g. with RingStorage).
+   * open() is called once when the sink is attached, close() when the series is reset;
+   * after that the sink receives nothing more.
+   */
+  template <typename XVector>
+  class SeriesSink
+  {
+  public:
+    virtual ~SeriesSink() {}
+
+    virtual void open(const std::vector<std::string>& /* column_names */) {}
+    virtual void write(double t, const XVector& x) = 0;
+    virtual void flush() {}                 // Make everything written so far available
+    virtual void close() { flush(); }
+  };
+
+
+
+  /*==============================================================================================*/
+
+
+
+  /* Sink writing the series to a text file in fixed-size chunks, in the same format as
+   * Series::dump_to_text (including 'precision', see io.h). Rows are accumulated in a buffer of 'chunk_rows' rows; full
+   * buffers are formatted and written by a ChunkWriter on a background thread, so the
+   * integration only stalls if the disk can't keep up with it.
+   * The file name is chosen with get_free_filename() when the sink is attached.
+   * Typical use, keeping only the rows needed for a delay of 'tau' in memory:
+   *   InterpolatedSeries<XVector, 1, 4, RingStorage> history(...);
+   *   history.add_sink(std::make_shared<SpillToText<XVector> >(directory, "series"));
+   */
+  template <typename XVector>
+  class SpillToText : public SeriesSink<XVector>
+  {
+  public:
+    SpillToText(const std::string& directory, const std::string& filename, size_t chunk_rows=4096,
+                bool include_labels=true, const std::string& format=", ", int max_files=100,
+                int precision=0)
+      : directory(directory), filename(filename), chunk_rows(chunk_rows),
+        include_labels(include_labels), format(format), max_files(max_files), precision(precision) {
+      assert(chunk_rows > 0);
+    }
+    SpillToText(const SpillToText&) = delete;
+    ~SpillToText() { close(); }
+
+    void open(const std::vector<std::string>& column_names) override {
+      assert(!writer);   // A sink can only be attached once
+      assert(column_names.size() == XVector::SizeAtCompileTime + 1);
+      outfilename = frantic::get_free_filename(directory, filename, max_files);  // Returns "" if unsuccessful
+      if (outfilename == "") {
+        std::cerr << "Unable to open a file to export series data." << std::endl;
+        return;
+      }
+      writer.reset(new ChunkWriter(outfilename, XVector::SizeAtCompileTime + 1, format, 4, precision));
+      write_series_header(writer->header(), column_names, include_labels, format);
+      chunk = writer->get_buffer();
+      chunk.reserve(chunk_rows * (XVector::SizeAtCompileTime + 1));
+    }
+
+    void write(double t, const XVector& x) override {
+      if (!writer) return;
+      chunk.push_back(t);
+      for(size_t i=0; i < XVector::SizeAtCompileTime; ++i) {
+        chunk.push_back(x(i));
+      }
+      if (chunk.size() >= chunk_rows * (XVector::SizeAtCompileTime + 1)) {
+        submit_chunk();
+      }
+    }
+
+    /* Write out the partial chunk and wait for the writer to catch up */
+    void flush() override {
+      if (!writer) return;
+      if (!chunk.empty()) {
+        submit_chunk();
+      }
+      writer->wait();
+    }
+
+    void close() override {
+      if (!writer) return;
+      if (!chunk.empty()) {
+        writer->submit(std::move(chunk));
+      }
+      writer->close();
+      writer.reset();
+      std::cout << "Series written to" << std::endl << outfilename << std::endl;
+    }
+
+    std::string get_filename() const { return outfilename; }
+
+  private:
+    std::string directory;
+    std::string filename;
+    size_t chunk_rows;
+    bool include_labels;
+    std::string format;
+    int max_files;
+    int precision;
+
+    std::string outfilename;
+    std::unique_ptr<ChunkWriter> writer;
+    std::vector<double> chunk;
+
+    void submit_chunk() {
+      writer->submit(std::move(chunk));
+      chunk = writer->get_buffer();   // Recycled buffers keep their capacity
+      chunk.reserve(chunk_rows * (XVector::SizeAtCompileTime + 1));
+    }
+  };
+
+
+
+  /*==============================================================================================*/
+
+
+
+  /* Sink resampling the series it is attached to onto the uniform grid t0, t0 + dt, ..., tn
+   * during the integration, and passing each resampled state to 'output'. This allows e.g.
+   * filling histograms, which require the same times in every run, from adaptive runs:
+   *   auto sink = std::make_shared<ResampleSink<XVector, XSeries> >(
+   *     history, 0, 0.01, [&](double t, const XVector& x) { density.update(t, x); });
+   *   history.add_sink(sink);
+   * 'Source' is an InterpolatedSeries type; the sink reads it through its own Cursor (see
+   * InterpolatedSeries::operator()(t, Cursor&)), so the integrator's lookups are unaffected.
+   * A grid time is resampled once 'lag' more rows have been recorded after it, so that the
+   * interpolation stencil is centered; flush() and close() resample up to the last row.
+   */
+  template <typename XVector, class Source>
+  class ResampleSink : public SeriesSink<XVector>
+  {
+  public:
+    ResampleSink(const Source& source, double t0, double dt, std::function<void(double, const XVector&)> output,
+                 double tn = std::numeric_limits<double>::infinity(), size_t lag = 2)
+      : source(source), t0(t0), dt(dt), tn(tn), lag(lag), output(output) {
+      assert(dt > 0);
+    }
+
+    void write(double t, const XVector& x) override {
+      times.push_back(t);
+      if (times.size() > lag) {
+        resample_until(times.front());
+        times.pop_front();
+      }
+    }
+    void flush() override {
+      if (!times.empty()) {
+        resample_until(times.back());
+      }
+    }
+
+    size_t get_nresampled() const { return n; }
+
+  private:
+    const Source& source;
+    double t0;
+    double dt;
+    double tn;
+    size_t lag;
+    std::function<void(double, const XVector&)> output;
+
+    typename Source::Cursor cursor;
+    std::deque<double> times;   // Last rows received, not yet used as limit
+    size_t n = 0;               // Number of grid times resampled so far
+
+    void resample_until(double limit) {
+      for (double t = t0 + n * dt; t <= limit and t <= tn; t = t0 + n * dt) {
+        output(t, source(t, cursor));
+        ++n;
+      }
+    }
+  };
+
+} // End namespace frantic
+
+#endif // SINKS_H
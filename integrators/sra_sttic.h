@@ -0,0 +1,72 @@
+#ifndef SRA_STTIC_H
+#define SRA_STTIC_H
+
+#include <cmath>
+
+#include "integrator.h"
+
+using std::vector;
+
+namespace integrators {
+
+  /* Stochastic Runge-Kutta integrator for additive noise (SRA1 of Rossler, "Runge-Kutta
+   * methods for the strong approximation of solutions of stochastic differential equations",
+   * SIAM J. Numer. Anal. 48 (2010)): strong order 1.5, weak order 2.
+   * Uses the same drift / diffusion_coeffs / diffusion_differentials interface as
+   * Euler_sttic. The diffusion coefficients may depend on t, but not on x (they are
+   * evaluated at the state at the start of the step).
+   * Besides dW, the scheme needs the iterated integral I_(1,0) = int int dW ds of each noise
+   * source, which is drawn from a second, independent call to diffusion_differentials(dt).
+   * A step costs two drift and two diffusion evaluations; the second drift evaluation is
+   * at t + 3/4 dt, so dt must not exceed the shortest registered delay.
+   */
+  template <class Differential>
+  class SRA_sttic : public frantic::Integrator<Differential>
+  {
+  private:
+    using XVector = typename Differential::XVector;
+
+  public:
+
+    using frantic::Integrator<Differential>::Integrator;  // Allow parent class overloads
+    SRA_sttic<Differential>() : frantic::Integrator<Differential>() {
+      this->order = 1.5;
+    }
+    virtual ~SRA_sttic() {}
+
+    /* Given a total derivative functor dX, integrate the DE problem. */
+    void integrate(const Differential& dX) {
+      auto& history = this->history;
+
+      assert(history.check_initialized());
+      if (history.dt > history.get_min_delay()) {
+        std::cerr << "SRA: the time step (" << history.dt << ") is longer than the shortest delay ("
+                  << history.get_min_delay() << ")." << std::endl;
+        assert(false);
+      }
+
+      const double dt = history.dt;
+      double t = history.t0;
+      XVector x = history(t);
+
+      for (ptrdiff_t i=0; i < history.nSteps; ++i) {   // nSteps is the number of steps from t0 to tn
+        const XVector f1 = dX.drift(t, x, history);
+        const auto g0 = dX.diffusion_coeffs(t, x, history);
+        const auto g1 = dX.diffusion_coeffs(t + dt, x, history);
+        const auto dW = dX.diffusion_differentials(dt);
+        const auto dU = dX.diffusion_differentials(dt);
+        const auto I10 = (dW + dU * (1 / std::sqrt(3.0))) * 0.5;   // I_(1,0) / dt
+
+        const XVector H2 = x + (0.75 * dt) * f1 + 1.5 * g1.sum_products(I10);
+        const XVector f2 = dX.drift(t + 0.75 * dt, H2, history);
+        x += dt * (f1 / 3.0 + f2 * (2.0 / 3.0)) + g1.sum_products(dW - I10) + g0.sum_products(I10);
+        t += dt;
+        history.update(t, x);
+      }
+    }
+
+  };
+
+}
+
+#endif // SRA_STTIC_H
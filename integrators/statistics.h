@@ -0,0 +1,125 @@
+#ifndef STATISTICS_H
+#define STATISTICS_H
+
+#include <cmath>
+#include <cstddef>
+#include <limits>
+
+#include <eigen3/Eigen/Dense>
+
+namespace frantic {
+
+  /* Accumulates component-wise statistics of a sequence of states, one state at a time,
+   * so that they are available at any point for O(1) cost and without keeping the states.
+   * Mean and variance use Welford's update, which is numerically stable even when the
+   * mean is large compared to the spread. With 'higher_moments', the third and fourth
+   * central moments are also accumulated (Pébay's single-pass formulas), giving the
+   * skewness and excess kurtosis.
+   */
+  template <typename XVector>
+  class RunningStatistics
+  {
+  public:
+    RunningStatistics(bool higher_moments=false) : higher_moments(higher_moments) { reset(); }
+
+    void reset() {
+      n = 0;
+      m1 = XVector::Zero();
+      m2 = XVector::Zero();
+      m3 = XVector::Zero();
+      m4 = XVector::Zero();
+      xmin = XVector::Constant(std::numeric_limits<double>::infinity());
+      xmax = XVector::Constant(-std::numeric_limits<double>::infinity());
+    }
+    void set_higher_moments(bool enable) {
+      higher_moments = enable;
+    }
+
+    void update(const XVector& x) {
+      double n1 = n;
+      ++n;
+      double nd = n;
+      XVector delta = x - m1;
+      XVector delta_n = delta / nd;
+      XVector term1 = delta.cwiseProduct(delta_n) * n1;
+      m1 += delta_n;
+      if (higher_moments) {
+        // Must use the old m2 and m3, so update in order m4, m3, m2
+        XVector delta_n2 = delta_n.cwiseProduct(delta_n);
+        m4 += term1.cwiseProduct(delta_n2) * (nd*nd - 3*nd + 3) + 6 * delta_n2.cwiseProduct(m2)
+              - 4 * delta_n.cwiseProduct(m3);
+        m3 += term1.cwiseProduct(delta_n) * (nd - 2) - 3 * delta_n.cwiseProduct(m2);
+      }
+      m2 += term1;
+      xmin = xmin.cwiseMin(x);
+      xmax = xmax.cwiseMax(x);
+    }
+
+    /* Add each column of 'xs' as a state, e.g. the members of an ensemble (see frantic::Ensemble) */
+    template <typename Derived>
+    void update_columns(const Eigen::MatrixBase<Derived>& xs) {
+      for (Eigen::Index j=0; j < xs.cols(); ++j) {
+        update(xs.col(j));
+      }
+    }
+
+    /* Combine with the statistics of another set of states, as if they had all been added
+     * here (e.g. to merge the statistics accumulated by separate threads). Higher moments are
+     * only combined if both accumulate them.
+     * Ref: Chan, Golub & LeVeque (1979); Pébay, Sandia report SAND2008-6212 (2008).
+     */
+    void merge(const RunningStatistics<XVector>& other) {
+      if (other.n == 0) return;
+      if (n == 0) {
+        *this = other;
+        return;
+      }
+      double na = n;
+      double nb = other.n;
+      double nd = na + nb;
+      XVector delta = other.m1 - m1;
+      XVector delta2 = delta.cwiseProduct(delta);
+      if (higher_moments and other.higher_moments) {
+        // Must use the old m2 and m3, so update in order m4, m3, m2
+        m4 += other.m4 + delta2.cwiseProduct(delta2) * (na*nb*(na*na - na*nb + nb*nb) / (nd*nd*nd))
+              + 6 * delta2.cwiseProduct(na*na * other.m2 + nb*nb * m2) / (nd*nd)
+              + 4 * delta.cwiseProduct(na * other.m3 - nb * m3) / nd;
+        m3 += other.m3 + delta2.cwiseProduct(delta) * (na*nb*(na - nb) / (nd*nd))
+              + 3 * delta.cwiseProduct(na * other.m2 - nb * m2) / nd;
+      } else {
+        higher_moments = false;
+      }
+      m2 += other.m2 + delta2 * (na*nb / nd);
+      m1 += delta * (nb / nd);
+      n += other.n;
+      xmin = xmin.cwiseMin(other.xmin);
+      xmax = xmax.cwiseMax(other.xmax);
+    }
+
+    size_t count() const { return n; }
+    XVector mean() const { return m1; }
+    XVector variance() const {   // Sample variance (n-1 denominator); zero for a single state
+      return (n > 1) ? XVector(m2 / (n - 1.)) : XVector(XVector::Zero());
+    }
+    XVector stddev() const { return variance().cwiseSqrt(); }
+    XVector min() const { return xmin; }
+    XVector max() const { return xmax; }
+    /* Only meaningful if higher moments are accumulated since the last reset */
+    XVector skewness() const {
+      return (std::sqrt(double(n)) * m3.array() / m2.array().pow(1.5)).matrix();
+    }
+    XVector kurtosis() const {    // Excess kurtosis
+      return (double(n) * m4.array() / m2.array().square() - 3).matrix();
+    }
+    bool has_higher_moments() const { return higher_moments; }
+
+  private:
+    bool higher_moments;
+    size_t n;
+    XVector m1, m2, m3, m4;   // Mean, and sums of the 2nd to 4th powers of deviations from the mean
+    XVector xmin, xmax;
+  };
+
+} // End namespace frantic
+
+#endif // STATISTICS_H
@@ -1,11 +1,16 @@
 #ifndef STOCHASTIC_H
 #define STOCHASTIC_H
 
+#include <cstddef>
+#include <cstdint>
 #include <random>
+#include <type_traits>
 
 namespace frantic {
 
   // shape should be derived from Eigen::DenseBase
+  // All default constructed instances produce the same sequence: instances meant to be
+  // independent (e.g. one per thread, see frantic::MonteCarlo) must be given different seeds.
   template <typename shape>
   class GaussianWhiteNoise
   {
@@ -14,11 +19,21 @@ namespace frantic {
     mutable double lastdt = 0;
 
   public:
+    GaussianWhiteNoise() {}
+    explicit GaussianWhiteNoise(std::uint64_t s) { seed(s); }
+
+    /* Restart the sequence from the given seed */
+    void seed(std::uint64_t s) {
+      std::seed_seq seq{static_cast<std::uint32_t>(s), static_cast<std::uint32_t>(s >> 32)};
+      generator.seed(seq);
+      dist.reset();
+    }
+
     // const required for this to be used in an rvalue
     shape operator () (double dt) const {
-      // \todo: check that normal lambda is really updated when dt changes
       // Based on code from here: http://eigen.tuxfamily.org/dox-devel/classEigen_1_1DenseBase.html#a15f13ef961b2c0709c8904281260222f
-      static auto normal = [&] (double) {return dist(generator);};
+      // The lambda must capture this instance's generator, so it can't be static
+      auto normal = [this] (double) {return dist(generator);};
 
       if (lastdt != dt) {
         // For multi-threading: ensure that the lines below are an atomic
@@ -40,6 +55,15 @@ namespace frantic {
     mutable double lastdt = 0;
 
   public:
+    GaussianWhiteNoise() {}
+    explicit GaussianWhiteNoise(std::uint64_t s) { seed(s); }
+
+    void seed(std::uint64_t s) {
+      std::seed_seq seq{static_cast<std::uint32_t>(s), static_cast<std::uint32_t>(s >> 32)};
+      generator.seed(seq);
+      dist.reset();
+    }
+
     double operator () (double dt) const {
       if (lastdt != dt) {
         std::normal_distribution<>::param_type p(0, sqrt(dt));
@@ -52,6 +76,29 @@ namespace frantic {
     }
   };
 
+  /* Noise term of a single source, i.e. diffusion coefficient times differential.
+   * For ensembles (see frantic::Ensemble), the coefficient is a (components x members) matrix
+   * and the differential a row vector with one independent increment per member (e.g. drawn
+   * with GaussianWhiteNoise<Eigen::Matrix<double, 1, N> >): each column is then scaled by the
+   * increment of its member.
+   */
+  template <typename TCoeff, typename TDifferential>
+  auto noise_product(const TCoeff& coeff, const TDifferential& dW) {
+    if constexpr (std::is_arithmetic<TDifferential>::value) {
+      return coeff * dW;
+    } else if constexpr (TDifferential::RowsAtCompileTime == 1 and TCoeff::ColsAtCompileTime != 1) {
+      return TCoeff((coeff.array().rowwise() * dW.array()).matrix());
+    } else {
+      return coeff * dW;
+    }
+  }
+
+  /* Heterogeneous list of values, one per noise source: the diffusion coefficients
+   * (XVector) and differentials (double) of the stochastic integrators. sum_products gives
+   * the noise term of a step, i.e. sum_j coeffs_j * dW_j (see noise_product); the element-wise operations build
+   * the combinations of differentials needed by higher order schemes (e.g. a * dW + b * dU).
+   * Elements are accessed with get<i>().
+   */
   // Primary declaration states that template can have as little as one type
   // All cases actually resolve to either one of the two specializations
   template <typename T1, typename ...Ts>
@@ -59,26 +106,47 @@ namespace frantic {
 
   template <typename T1, typename T2, typename ...Ts>
   struct Tuple<T1, T2, Ts...> {
+    static constexpr size_t size = 2 + sizeof...(Ts);
     T1 val1;
     Tuple<T2, Ts...> vals;
 
     Tuple(T1 val1, T2 val2, Ts... vals) : val1(val1), vals(val2, vals...) {}
+    Tuple(T1 val1, Tuple<T2, Ts...> vals) : val1(val1), vals(vals) {}
 
     template<typename TOther>
-    auto sum_products(TOther other) {
-      return val1 * other.val1 + vals.multiply(other.vals);
+    auto sum_products(const TOther& other) const {
+      return noise_product(val1, other.val1) + vals.sum_products(other.vals);
     }
+
+    template <size_t i> auto& get() {
+      if constexpr (i == 0) { return val1; } else { return vals.template get<i-1>(); }
+    }
+    template <size_t i> const auto& get() const {
+      if constexpr (i == 0) { return val1; } else { return vals.template get<i-1>(); }
+    }
+
+    Tuple operator+ (const Tuple& other) const { return Tuple(val1 + other.val1, vals + other.vals); }
+    Tuple operator- (const Tuple& other) const { return Tuple(val1 - other.val1, vals - other.vals); }
+    Tuple operator* (double a) const { return Tuple(val1 * a, vals * a); }
   };
 
   template<typename T1>
   struct Tuple<T1> {
+    static constexpr size_t size = 1;
     T1 val1;
     Tuple(T1 val1) : val1(val1) {}
 
     template<typename TOther>
-    auto sum_products (TOther other) {
-      return val1 * other.val1;
+    auto sum_products (const TOther& other) const {
+      return noise_product(val1, other.val1);
     }
+
+    template <size_t i> T1& get() { static_assert(i == 0, "Tuple index out of range"); return val1; }
+    template <size_t i> const T1& get() const { static_assert(i == 0, "Tuple index out of range"); return val1; }
+
+    Tuple operator+ (const Tuple& other) const { return Tuple(val1 + other.val1); }
+    Tuple operator- (const Tuple& other) const { return Tuple(val1 - other.val1); }
+    Tuple operator* (double a) const { return Tuple(val1 * a); }
   };
 
 }
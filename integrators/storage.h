@@ -0,0 +1,420 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <assert.h>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <new>             // Required for std::align_val_t
+#include <string>
+#include <vector>
+#include <sstream>
+#include <type_traits>
+
+#include <eigen3/Eigen/Dense>
+
+#include "o2scl/table.h"
+#include "io.h"
+
+namespace frantic {
+
+  /* Storage policies for Series
+   * A storage policy holds the rows (t, x) of a series; Series<XVector, Storage> derives
+   * from Storage<XVector> and only uses the interface below, so policies can be swapped
+   * without touching the integrators. Every policy provides:
+   *   - get_nlines(), get_maxlines(), inc_maxlines(n), set_nlines(n), clear_data()
+   *   - get_ncolumns(), get_column_name(icol), column_index(name), line_of_names(names)
+   *   - get(icol, row)       : column 0 is time, columns 1..n the components of XVector
+   *   - time(row)            : shorthand for get(0, row)
+   *   - row(row)             : the state at a row, as an XVector or an expression convertible to one
+   *   - set_row(row, t, x)   : rows beyond the current end are added
+   *   - append_row(t, x)
+   *   - first_line()         : index of the oldest row still stored (0 unless old rows are discarded)
+   *   - set_retention(span, extra_rows) : hint that only rows within 'span' of the latest time,
+   *                            plus 'extra_rows' before those, will be read again
+   * Column numbering follows o2scl::table, so code written for the table keeps working.
+   * Row indices are always absolute, i.e. they count from the first row ever added.
+   */
+
+
+  /* Tracks whether the times of a set of rows lie on a uniform grid, so that the row at a
+   * given time can be computed instead of searched for. Rows are passed to add() as they are
+   * written; times only need to be within a quarter step of the grid, since the estimate is
+   * then corrected by looking at neighbouring rows (see lookup_row in history.tpp).
+   * Any irregularity (step change, duplicate times, rows written out of order) makes the
+   * grid non-uniform until the next clear().
+   */
+  class GridIndex
+  {
+  public:
+    void clear() { count = 0; uniform = false; }
+    void add(size_t row, double t) {
+      if (count == 0 or row <= first_row) {
+        // New first row (e.g. initial condition): restart
+        first_row = row;
+        origin = t;
+        count = 1;
+        uniform = false;
+      } else if (row == first_row + count) {
+        if (count == 1) {
+          step = t - origin;
+          uniform = (step > 0);
+        } else if (uniform) {
+          double deviation = std::abs(t - (origin + count * step));
+          uniform = (deviation <= 0.25 * step);
+        }
+        ++count;
+      } else {
+        uniform = false;   // Rows skipped or overwritten
+      }
+    }
+    /* Forget the rows from 'nlines' on (e.g. rolled back by an integrator). Whether the
+     * remaining rows are uniform is kept as it was, which may be pessimistic. */
+    void truncate(size_t nlines) {
+      if (count > 0 and nlines < first_row + count) {
+        count = (nlines > first_row) ? nlines - first_row : 0;
+        if (count <= 1) {
+          uniform = false;
+        }
+      }
+    }
+    bool is_uniform() const { return uniform; }
+    size_t get_first_row() const { return first_row; }
+    double get_origin() const { return origin; }
+    double get_step() const { return step; }
+    /* Row whose grid time is the closest below or at 't', clamped to [lo, hi] */
+    size_t estimate(double t, size_t lo, size_t hi) const {
+      double offset = std::floor((t - origin) / step);
+      if (offset < double(lo) - double(first_row)) return lo;
+      if (offset > double(hi) - double(first_row)) return hi;
+      return first_row + static_cast<size_t>(offset);
+    }
+
+  private:
+    size_t first_row = 0;
+    size_t count = 0;
+    double origin = 0;
+    double step = 0;
+    bool uniform = false;
+  };
+
+
+
+  /*==============================================================================================*/
+
+
+
+  /* Allocator returning memory aligned on 'Alignment' bytes (default: one cache line).
+   * Used for the buffers of ContiguousStorage, so that rows can be mapped by Eigen
+   * without copies and vectorized loads never straddle two cache lines at the start of a buffer.
+   */
+  template <typename T, std::size_t Alignment = 64>
+  struct AlignedAllocator
+  {
+    using value_type = T;
+    template <typename U>
+    struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+    AlignedAllocator() noexcept {}
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept {}
+
+    T* allocate(std::size_t n) {
+      return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+    }
+    void deallocate(T* p, std::size_t) noexcept {
+      ::operator delete(p, std::align_val_t(Alignment));
+    }
+  };
+  template <typename T, typename U, std::size_t Alignment>
+  bool operator== (const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&) { return true; }
+  template <typename T, typename U, std::size_t Alignment>
+  bool operator!= (const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&) { return false; }
+
+
+
+  /*==============================================================================================*/
+
+
+
+  /* Table-backed storage: one std::vector per column, managed by o2scl::table.
+   * This is the original layout of Series and remains the default, since some code relies
+   * on o2scl table features (the other policies provide only the interface above, which is
+   * enough for Curve).
+   * Reading a full state requires gathering one double from each column.
+   */
+  template <typename XVector>
+  class TableStorage : public o2scl::table<std::vector<double> >
+  {
+  private:
+    using table = o2scl::table<std::vector<double> >;
+
+  public:
+    using RowType = XVector;   // row() must copy, since components live in different columns
+
+    TableStorage(size_t cmaxlines=0) : table(cmaxlines) {}
+
+    double time(size_t row) const { return table::get(0, row); }
+    XVector row(size_t row) const;
+    void set_row(size_t row, double t, const XVector& x);
+    void append_row(double t, const XVector& x);
+    size_t column_index(const std::string& name) const;
+    size_t first_line() const { return 0; }
+    void set_retention(double, size_t) {}  // All rows are kept
+  };
+
+
+
+  /*==============================================================================================*/
+
+
+
+  /* Column names of the storage policies which don't derive from o2scl::table, with the
+   * same lookups: line_of_names takes a space separated list, and column_index returns the
+   * index of a column from its name.
+   */
+  class ColumnNames
+  {
+  public:
+    ColumnNames(size_t ncolumns) : ncolumns(ncolumns) {}
+
+    std::string get_column_name(size_t icol) const { return column_names[icol]; }
+    size_t column_index(const std::string& name) const {
+      for(size_t i=0; i < column_names.size(); ++i) {
+        if (column_names[i] == name) {
+          return i;
+        }
+      }
+      std::cerr << "No column has name " << name << std::endl;
+      assert(false);
+      return 0;
+    }
+    void line_of_names(const std::string& names) {
+      std::istringstream sstream(names);
+      std::string name;
+      column_names.clear();
+      while (sstream >> name) {
+        column_names.push_back(name);
+      }
+      assert(column_names.size() == ncolumns);
+    }
+
+  protected:
+    void set_column_names(const std::vector<std::string>& names) {
+      assert(names.size() == ncolumns);
+      column_names = names;
+    }
+
+  private:
+    size_t ncolumns;
+    std::vector<std::string> column_names;
+  };
+
+
+
+  /*==============================================================================================*/
+
+
+
+  /* Contiguous storage: time column and XVector rows kept in two 64-byte aligned buffers,
+   * the rows interleaved component by component (row-major). This avoids the per-component
+   * scatter/gather of TableStorage: writing or reading a state is a single contiguous copy,
+   * and rows and columns can be exposed as Eigen::Map views without copying.
+   * Views are invalidated when the buffers grow (i.e. when inc_maxlines is called,
+   * explicitly or by append_row), in the same way as std::vector iterators.
+   */
+  template <typename XVector>
+  class ContiguousStorage : public ColumnNames
+  {
+  public:
+    static constexpr int ncomponents = XVector::SizeAtCompileTime;
+    using Buffer = std::vector<double, AlignedAllocator<double> >;
+
+    using RowType = Eigen::Map<const XVector>;
+    using RowMap = Eigen::Map<XVector>;
+    using ColumnMap = Eigen::Map<const Eigen::VectorXd, Eigen::Unaligned, Eigen::InnerStride<> >;
+    using TimeMap = Eigen::Map<const Eigen::VectorXd, Eigen::Aligned64>;
+    // Eigen does not allow row-major storage for single column matrices
+    using BlockMap = Eigen::Map<const Eigen::Matrix<double, Eigen::Dynamic, ncomponents,
+                                                    (ncomponents == 1) ? Eigen::ColMajor : Eigen::RowMajor>,
+                                Eigen::Aligned64>;
+
+    ContiguousStorage(size_t cmaxlines=0);
+
+    size_t get_nlines() const { return nlines; }
+    size_t get_maxlines() const { return maxlines; }
+    void inc_maxlines(size_t n);
+    void set_nlines(size_t n);
+    void clear_data() { nlines = 0; }
+
+    size_t get_ncolumns() const { return ncomponents + 1; }
+
+    double get(size_t icol, size_t row) const {
+      return (icol == 0) ? tdata[row] : xdata[row * ncomponents + icol - 1];
+    }
+    double time(size_t row) const { return tdata[row]; }
+    RowType row(size_t row) const { return RowType(xdata.data() + row * ncomponents); }
+    RowMap row(size_t row) { return RowMap(xdata.data() + row * ncomponents); }
+    /* Component 'icomponent' (0-based, i.e. table column icomponent + 1) over all stored rows */
+    ColumnMap column(size_t icomponent) const {
+      return ColumnMap(xdata.data() + icomponent, nlines, Eigen::InnerStride<>(ncomponents));
+    }
+    TimeMap times() const { return TimeMap(tdata.data(), nlines); }
+    /* All stored rows as one (nlines x ncomponents) matrix */
+    BlockMap rows() const { return BlockMap(xdata.data(), nlines, ncomponents); }
+
+    void set_row(size_t row, double t, const XVector& x);
+    void append_row(double t, const XVector& x);
+    size_t first_line() const { return 0; }
+    void set_retention(double, size_t) {}  // All rows are kept
+
+  private:
+    size_t nlines = 0;
+    size_t maxlines = 0;
+    Buffer tdata;
+    Buffer xdata;
+  };
+
+
+
+  /*==============================================================================================*/
+
+
+
+  /* Ring buffer storage: same aligned row-major layout as ContiguousStorage, but only a
+   * bounded window of the most recent rows is kept. This is meant for long runs of delayed
+   * systems, where lookups only ever go back by the maximum delay (plus the interpolation
+   * stencil), so memory is O(τ/dt) instead of O(T/dt).
+   * The window is set with set_retention(span, extra_rows): the oldest row is overwritten only
+   * once at least 'extra_rows' rows older than (latest time - span) remain. If the buffer
+   * is full and no row can be discarded (e.g. because an adaptive integrator reduced its step),
+   * the buffer grows instead; nothing that might still be read is ever overwritten.
+   * Until set_retention is called, no row is discarded.
+   * Rows keep their absolute indices (get_nlines() counts all rows ever added); accessing a
+   * row which has been discarded throws std::out_of_range.
+   * Only forward integration (increasing times) is supported.
+   */
+  template <typename XVector>
+  class RingStorage : public ColumnNames
+  {
+  public:
+    static constexpr int ncomponents = XVector::SizeAtCompileTime;
+    using Buffer = std::vector<double, AlignedAllocator<double> >;
+
+    using RowType = Eigen::Map<const XVector>;
+    using RowMap = Eigen::Map<XVector>;
+
+    RingStorage(size_t cmaxlines=0);
+
+    size_t get_nlines() const { return nlines; }
+    size_t get_maxlines() const { return std::numeric_limits<size_t>::max(); }  // Row indices are unbounded
+    void inc_maxlines(size_t n) { reserve(capacity + n); }
+    void set_nlines(size_t n);
+    void clear_data() { nlines = 0; first = 0; }
+
+    size_t get_ncolumns() const { return ncomponents + 1; }
+
+    double get(size_t icol, size_t row) const {
+      check_line(row);
+      return (icol == 0) ? tdata[row & mask] : xdata[(row & mask) * ncomponents + icol - 1];
+    }
+    double time(size_t row) const { check_line(row); return tdata[row & mask]; }
+    RowType row(size_t row) const { check_line(row); return RowType(xdata.data() + (row & mask) * ncomponents); }
+    RowMap row(size_t row) { check_line(row); return RowMap(xdata.data() + (row & mask) * ncomponents); }
+
+    void set_row(size_t row, double t, const XVector& x);
+    void append_row(double t, const XVector& x);
+    size_t first_line() const { return first; }
+    void set_retention(double span, size_t extra_rows) {
+      retention_span = span;
+      retention_rows = extra_rows;
+    }
+    size_t get_capacity() const { return capacity; }
+
+  private:
+    size_t nlines = 0;      // Total number of rows added since the last clear
+    size_t first = 0;       // Absolute index of the oldest stored row
+    size_t capacity = 0;    // Always a power of two, so that the physical index is (row & mask)
+    size_t mask = 0;
+    double retention_span = std::numeric_limits<double>::infinity();
+    size_t retention_rows = 0;
+    Buffer tdata;
+    Buffer xdata;
+
+    void reserve(size_t n);
+    void check_line(size_t row) const {
+      if (row < first or row >= nlines) {
+        throw std::out_of_range("Row " + std::to_string(row) + " is not stored in the ring buffer (stored rows: "
+                                + std::to_string(first) + " to " + std::to_string(nlines) + " exclusive).");
+      }
+    }
+  };
+
+
+
+
+  /*==============================================================================================*/
+
+
+
+  /* Read-only view of the series data in a mapped binary file (see BinaryHeader in io.h).
+   * Nothing is copied or parsed: time(), get() and row() read directly from the mapping, and
+   * column() gives contiguous views. Since data is stored by column, row() is a strided map.
+   * Attach data with Series::read_from_binary(); the file stays mapped until clear_data()
+   * (e.g. Series::reset()) or destruction. Any attempt to write throws std::logic_error.
+   */
+  template <typename XVector>
+  class MappedStorage : public ColumnNames
+  {
+  public:
+    static constexpr int ncomponents = XVector::SizeAtCompileTime;
+
+    using RowType = Eigen::Map<const XVector, Eigen::Unaligned, Eigen::InnerStride<> >;
+    // Only the time column is aligned: the others start nrows values further on
+    using ColumnMap = Eigen::Map<const Eigen::VectorXd, Eigen::Unaligned>;
+    using TimeMap = Eigen::Map<const Eigen::VectorXd, Eigen::Aligned64>;
+
+    MappedStorage(size_t = 0) : ColumnNames(ncomponents + 1) {}
+
+    void attach(std::shared_ptr<const MappedFile> file, const double* columns, size_t nrows,
+                const std::vector<std::string>& names);
+
+    size_t get_nlines() const { return nlines; }
+    size_t get_maxlines() const { return nlines; }
+    void inc_maxlines(size_t) {}    // Nothing to reserve
+    void set_nlines(size_t n);
+    void clear_data() { file.reset(); data = nullptr; nlines = 0; stride = 0; }
+
+    size_t get_ncolumns() const { return ncomponents + 1; }
+
+    double get(size_t icol, size_t row) const { return data[icol * stride + row]; }
+    double time(size_t row) const { return data[row]; }
+    RowType row(size_t row) const { return RowType(data + stride + row, Eigen::InnerStride<>(stride)); }
+    ColumnMap column(size_t icomponent) const { return ColumnMap(data + (icomponent + 1) * stride, nlines); }
+    TimeMap times() const { return TimeMap(data, nlines); }
+
+    void set_row(size_t, double, const XVector&) { throw std::logic_error("MappedStorage is read-only."); }
+    void append_row(double, const XVector&) { throw std::logic_error("MappedStorage is read-only."); }
+    size_t first_line() const { return 0; }
+    void set_retention(double, size_t) {}
+
+  private:
+    std::shared_ptr<const MappedFile> file;
+    const double* data = nullptr;
+    size_t nlines = 0;
+    size_t stride = 0;    // Number of rows in the file, i.e. the length of each column
+  };
+
+  /* True for storage policies which can only view a mapped file (used by Series::read_from_binary) */
+  template <typename S> struct is_mapped_storage : std::false_type {};
+  template <typename XVector> struct is_mapped_storage<MappedStorage<XVector> > : std::true_type {};
+
+#include "storage.tpp"
+
+} // End namespace frantic
+
+#endif // STORAGE_H
@@ -0,0 +1,216 @@
+#ifndef STORAGE_TPP
+#define STORAGE_TPP
+
+/* --------------------------------------------------------------------------
+ * TableStorage
+ * --------------------------------------------------------------------------*/
+
+template <typename XVector> XVector TableStorage<XVector>::row(size_t row) const {
+  XVector retval;
+  for(size_t i=0; i<XVector::SizeAtCompileTime; ++i) {
+    retval(i) = table::get(i+1, row);
+  }
+  return retval;
+}
+
+/* Set the time and value of a particular row; rows past the current end are added
+ * The onus is on the caller to ensure that \c t is valid at this \c row.
+ */
+template <typename XVector> void TableStorage<XVector>::set_row(size_t row, double t, const XVector& x) {
+  if (row >= this->get_maxlines()) {
+    this->inc_maxlines(row + 1 - this->get_maxlines());
+  }
+  if (row >= this->get_nlines()) {
+    this->set_nlines(row + 1);
+  }
+  table::set(0, row, t);
+  for(size_t i=0; i<XVector::SizeAtCompileTime; ++i) {
+    table::set(i+1, row, x(i));
+  }
+}
+
+/* Overloaded data adding function to allow using the XVector type
+ * \todo: reinstate error checking
+ */
+template <typename XVector> void TableStorage<XVector>::append_row(double t, const XVector& x) {
+  // Virtually a copy of void line_of_data() from o2scl/table.h
+  if (maxlines==0) inc_maxlines(5);
+  if (nlines>=maxlines) inc_maxlines(maxlines);
+
+  if (intp_set) {
+        intp_set=false;
+        delete si;
+  }
+
+  if (nlines<maxlines && XVector::SizeAtCompileTime<=(atree.size())) {
+
+    set_nlines(nlines+1);
+    table::set(0, nlines-1, t);
+    for(size_t i=0; i<XVector::SizeAtCompileTime; ++i) {
+      table::set(i+1, nlines-1, x(i));
+	}
+
+	return;
+  }
+
+//  O2SCL_ERR("Not enough lines or columns in line_of_data().",exc_einval);
+  return;
+}
+
+template <typename XVector> size_t TableStorage<XVector>::column_index(const std::string& name) const {
+  for(size_t i=0; i < this->get_ncolumns(); ++i) {
+    if (this->get_column_name(i) == name) {
+      return i;
+    }
+  }
+  std::cerr << "No column has name " << name << std::endl;
+  assert(false);
+  return 0;
+}
+
+
+/* --------------------------------------------------------------------------
+ * ContiguousStorage
+ * --------------------------------------------------------------------------*/
+
+template <typename XVector> ContiguousStorage<XVector>::ContiguousStorage(size_t cmaxlines)
+  : ColumnNames(ncomponents + 1) {
+  if (cmaxlines > 0) {
+    inc_maxlines(cmaxlines);
+  }
+}
+
+/* Append 'n' lines to the allocated buffers. Existing data is preserved, but views
+ * obtained from row(), column(), etc. are invalidated.
+ */
+template <typename XVector> void ContiguousStorage<XVector>::inc_maxlines(size_t n) {
+  maxlines += n;
+  tdata.resize(maxlines);
+  xdata.resize(maxlines * ncomponents);
+}
+
+template <typename XVector> void ContiguousStorage<XVector>::set_nlines(size_t n) {
+  if (n > maxlines) {
+    inc_maxlines(n - maxlines);
+  }
+  nlines = n;
+}
+
+template <typename XVector> void ContiguousStorage<XVector>::set_row(size_t row, double t, const XVector& x) {
+  if (row >= nlines) {
+    set_nlines(row + 1);
+  }
+  tdata[row] = t;
+  this->row(row) = x;
+}
+
+template <typename XVector> void ContiguousStorage<XVector>::append_row(double t, const XVector& x) {
+  if (maxlines == 0) inc_maxlines(5);
+  if (nlines >= maxlines) inc_maxlines(maxlines);  // Double capacity, as o2scl::table does
+
+  tdata[nlines] = t;
+  this->row(nlines) = x;
+  ++nlines;
+}
+
+/* --------------------------------------------------------------------------
+ * RingStorage
+ * --------------------------------------------------------------------------*/
+
+template <typename XVector> RingStorage<XVector>::RingStorage(size_t cmaxlines)
+  : ColumnNames(ncomponents + 1) {
+  // cmaxlines is the total number of rows expected; we don't want to allocate all of them,
+  // so only use it as an upper bound on the initial buffer
+  reserve(std::min<size_t>(cmaxlines, 1024));
+}
+
+/* Make room for at least 'n' stored rows. Capacity is rounded up to a power of two.
+ * Stored rows are moved to their position in the new buffer; their absolute indices don't change.
+ */
+template <typename XVector> void RingStorage<XVector>::reserve(size_t n) {
+  if (n <= capacity) return;
+
+  size_t newcapacity = 1;
+  while (newcapacity < n) newcapacity <<= 1;
+  size_t newmask = newcapacity - 1;
+
+  Buffer newtdata(newcapacity);
+  Buffer newxdata(newcapacity * ncomponents);
+  for(size_t row = first; row < nlines; ++row) {
+    newtdata[row & newmask] = tdata[row & mask];
+    for(size_t i=0; i < ncomponents; ++i) {
+      newxdata[(row & newmask) * ncomponents + i] = xdata[(row & mask) * ncomponents + i];
+    }
+  }
+
+  tdata.swap(newtdata);
+  xdata.swap(newxdata);
+  capacity = newcapacity;
+  mask = newmask;
+}
+
+template <typename XVector> void RingStorage<XVector>::set_nlines(size_t n) {
+  if (n < first) {
+    clear_data();
+  } else {
+    reserve(n - first);
+    nlines = n;
+  }
+}
+
+template <typename XVector> void RingStorage<XVector>::set_row(size_t row, double t, const XVector& x) {
+  if (row == nlines) {
+    append_row(t, x);
+  } else {
+    if (row > nlines) {
+      set_nlines(row + 1);
+    }
+    check_line(row);
+    tdata[row & mask] = t;
+    this->row(row) = x;
+  }
+}
+
+template <typename XVector> void RingStorage<XVector>::append_row(double t, const XVector& x) {
+  if (nlines - first == capacity) {
+    // Buffer is full: overwrite the oldest row if it is no longer needed, otherwise grow
+    if (first + retention_rows < nlines and tdata[(first + retention_rows) & mask] < t - retention_span) {
+      ++first;
+    } else {
+      reserve(std::max<size_t>(2 * capacity, 8));
+    }
+  }
+
+  tdata[nlines & mask] = t;
+  RowMap(xdata.data() + (nlines & mask) * ncomponents) = x;
+  ++nlines;
+}
+
+/* --------------------------------------------------------------------------
+ * MappedStorage
+ * --------------------------------------------------------------------------*/
+
+/* 'columns' points to the first of the 1 + ncomponents columns of 'nrows' values
+ * (time first), somewhere within 'file'. The columns follow each other without padding,
+ * so only the first one, which starts the data block, is aligned on 64 bytes.
+ */
+template <typename XVector>
+void MappedStorage<XVector>::attach(std::shared_ptr<const MappedFile> file, const double* columns, size_t nrows,
+                                    const std::vector<std::string>& names) {
+  assert(reinterpret_cast<uintptr_t>(columns) % 64 == 0);
+  this->file = file;
+  data = columns;
+  nlines = nrows;
+  stride = nrows;
+  this->set_column_names(names);
+}
+
+/* Rows can be hidden from the end of the view, but not added */
+template <typename XVector> void MappedStorage<XVector>::set_nlines(size_t n) {
+  if (n > stride) {
+    throw std::logic_error("MappedStorage is read-only: cannot add rows.");
+  }
+  nlines = n;
+}
+
+#endif
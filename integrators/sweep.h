@@ -0,0 +1,270 @@
+/* Parameter sweeps: runs of a simulation for each of a set of parameter points, with
+ * replicates, distributed over threads and collected in a table indexed by point and replicate.
+ */
+
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <assert.h>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "io.h"
+#include "montecarlo.h"
+#include "parallel.h"
+
+namespace frantic {
+
+  /* Values of some parameters, by key */
+  using ParameterPoint = std::vector<std::pair<std::string, double> >;
+
+  /* Set the parameters of a ParameterTuple (or UIParameterTuple) to the values of 'point' */
+  template <typename Tuple>
+  void apply_point(const ParameterPoint& point, Tuple& parameters) {
+    for (const auto& p : point) {
+      parameters.update(p.first, p.second);
+    }
+  }
+
+  /* List of parameter points, built from a list (add_point) and/or as a grid (add_axis).
+   * add_axis combines every point already there with each of the given values, so a grid
+   * is built one axis at a time, the first added varying slowest.
+   * All points should have the same keys, in the same order, for the result table to have
+   * consistent columns.
+   */
+  class ParameterGrid
+  {
+  public:
+    ParameterGrid& add_point(ParameterPoint point) {
+      points.push_back(std::move(point));
+      return *this;
+    }
+    ParameterGrid& add_axis(const std::string& key, const std::vector<double>& values) {
+      if (points.empty()) points.emplace_back();
+      std::vector<ParameterPoint> product;
+      product.reserve(points.size() * values.size());
+      for (const ParameterPoint& point : points) {
+        for (double value : values) {
+          product.push_back(point);
+          product.back().emplace_back(key, value);
+        }
+      }
+      points.swap(product);
+      return *this;
+    }
+    /* n values evenly spaced from first to last, both included */
+    static std::vector<double> linspace(double first, double last, size_t n) {
+      std::vector<double> values(n, first);
+      for (size_t i=1; i < n; ++i) {
+        values[i] = first + (last - first) * i / (n - 1);
+      }
+      return values;
+    }
+
+    size_t size() const { return points.size(); }
+    const ParameterPoint& operator[](size_t i) const { return points[i]; }
+    std::vector<std::string> keys() const {
+      std::vector<std::string> k;
+      if (!points.empty()) {
+        for (const auto& p : points[0]) k.push_back(p.first);
+      }
+      return k;
+    }
+
+  private:
+    std::vector<ParameterPoint> points;
+  };
+
+  /* Results of a sweep: one Result per (point, replicate) */
+  template <typename Result>
+  struct SweepResults
+  {
+    ParameterGrid grid;
+    size_t nreplicates = 0;
+    std::vector<Result> results;   // Replicates of a point are contiguous
+
+    size_t npoints() const { return grid.size(); }
+    Result& operator()(size_t point, size_t replicate) { return results[point * nreplicates + replicate]; }
+    const Result& operator()(size_t point, size_t replicate) const { return results[point * nreplicates + replicate]; }
+
+    /* Combine the replicates of each point, for results providing merge(const Result&)
+     * (e.g. HistCollection, RunningStatistics) */
+    std::vector<Result> merge_replicates() const {
+      assert(nreplicates > 0);
+      std::vector<Result> merged;
+      merged.reserve(npoints());
+      for (size_t p=0; p < npoints(); ++p) {
+        merged.push_back((*this)(p, 0));
+        for (size_t r=1; r < nreplicates; ++r) {
+          merged.back().merge((*this)(p, r));
+        }
+      }
+      return merged;
+    }
+
+    /* Write the table as text, for results that are numbers or Eigen vectors: one row per
+     * (point, replicate), with the parameter values, the replicate and the result's components.
+     * 'result_names' labels the result columns (default: "result_i").
+     */
+    void dump_to_text(const std::string& directory, const std::string& filename,
+                      bool include_labels = true, const std::string& format = ", ",
+                      std::vector<std::string> result_names = {}, int max_files = 100,
+                      unsigned nthreads = 1) const;
+
+  private:
+    static size_t result_size(const Result& result) {
+      if constexpr (std::is_arithmetic<Result>::value) {
+        return 1;
+      } else {
+        return result.size();
+      }
+    }
+    static double result_component(const Result& result, size_t i) {
+      if constexpr (std::is_arithmetic<Result>::value) {
+        return result;
+      } else {
+        return result(i);
+      }
+    }
+  };
+
+  template <typename Result>
+  void SweepResults<Result>::dump_to_text(const std::string& directory, const std::string& filename,
+                                          bool include_labels, const std::string& format,
+                                          std::vector<std::string> result_names, int max_files,
+                                          unsigned nthreads) const {
+    std::string outfilename = frantic::get_free_filename(directory, filename, max_files);  // Returns "" if unsuccessful
+
+    if (outfilename != "") {
+      std::fstream outfile(outfilename.c_str(), std::ios::out);
+
+      const std::vector<std::string> keys = grid.keys();
+      const size_t nparams = keys.size();
+      const size_t nresult = results.empty() ? 0 : result_size(results[0]);
+      for (size_t i=result_names.size(); i < nresult; ++i) {
+        result_names.push_back("result_" + std::to_string(i));
+      }
+
+      outfile << "# Format: Parameter sweep" << std::endl;
+      outfile << "# Details: One row per parameter point and replicate" << std::endl;
+      outfile << "#          Columns: the " << nparams << " parameter values, the replicate, then the result" << std::endl;
+      if (include_labels) {
+        std::array<std::string, 3> formatStrings = get_format_strings(format);
+        std::string line = formatStrings[0];
+        for (const std::string& key : keys) line += key + formatStrings[1];
+        line += "replicate";
+        for (size_t i=0; i < nresult; ++i) line += formatStrings[1] + result_names[i];
+        outfile << std::endl << line << formatStrings[2] << std::endl;
+      }
+
+      write_text_rows(outfile, results.size(), nparams + 1 + nresult, [&](size_t j, size_t i) {
+          size_t point = i / nreplicates;
+          if (j < nparams) {
+            assert(grid[point].size() == nparams);
+            return grid[point][j].second;
+          } else if (j == nparams) {
+            return double(i % nreplicates);
+          } else {
+            assert(result_size(results[i]) == nresult);
+            return result_component(results[i], j - nparams - 1);
+          }
+        }, format, nthreads);
+
+      outfile.close();
+
+      std::cout << "Parameter sweep written to \n" + outfilename + "\n";
+    } else {
+      std::cerr << "Unable to open a file to export the parameter sweep" << std::endl;
+    }
+  }
+
+
+  /* Runs a simulation 'nreplicates' times for each point of a ParameterGrid, spread over
+   * 'nthreads' threads (0: one per core). Each (point, replicate) is a job. Jobs are scheduled
+   * dynamically, not by work stealing: each thread takes the next job from a shared atomic
+   * counter when it finishes one (see parallel_for_workers), so threads which get short runs
+   * (e.g. adaptive steps on an easy point) simply do more of them.
+   * As with MonteCarlo, each thread (worker) owns a Simulation built by the factory on its
+   * first job, and reused for the following ones: the job function must set all the
+   * parameters it depends on (see apply_point), and reset the simulation as needed.
+   * The job function is called as
+   *     job(sim, point, replicate, seed)
+   * and returns the result of the run, e.g. a final state, summary statistics or a density.
+   * By default, replicate r of every point gets the same seed (common random numbers), so
+   * that differences between points aren't blurred by different noise; with
+   * set_common_random_numbers(false), each job gets its own seed.
+   * Example, scanning the delay of a delayed OU process without the UI:
+   *   frantic::ParameterGrid grid;
+   *   grid.add_axis("tau", frantic::ParameterGrid::linspace(0.5, 2, 16));
+   *   frantic::ParameterSweep<Sim> sweep([](unsigned) { return std::make_unique<Sim>(); });
+   *   auto table = sweep.run(grid, 100, [](Sim& sim, const frantic::ParameterPoint& point,
+   *                                        size_t, std::uint64_t seed) {
+   *       frantic::apply_point(point, sim.dX.parameters);
+   *       sim.dX.generator1.seed(seed);
+   *       sim.run_loop();
+   *       return sim.integrator.history(sim.integrator.history.tn);
+   *     });
+   *   table.dump_to_text(directory, "sweep.txt");
+   */
+  template <class Simulation>
+  class ParameterSweep
+  {
+  public:
+    using Factory = std::function<std::unique_ptr<Simulation>(unsigned worker)>;
+
+    ParameterSweep(Factory factory, unsigned nthreads = 0, std::uint64_t seed = 0)
+      : factory(std::move(factory)), nthreads(nthreads), seed(seed) {}
+
+    void set_nthreads(unsigned n) { nthreads = n; }
+    void set_seed(std::uint64_t s) { seed = s; }
+    void set_common_random_numbers(bool enable) { common_random_numbers = enable; }
+
+    /* Run all jobs, and return their results. The first exception thrown by a job is
+     * rethrown once the threads have finished. */
+    template <typename Job>
+    auto run(const ParameterGrid& grid, size_t nreplicates, Job job)
+      -> SweepResults<std::decay_t<decltype(job(std::declval<Simulation&>(), grid[0], size_t(0), std::uint64_t(0)))> > {
+      using Result = std::decay_t<decltype(job(std::declval<Simulation&>(), grid[0], size_t(0), std::uint64_t(0)))>;
+      SweepResults<Result> table;
+      table.grid = grid;
+      table.nreplicates = nreplicates;
+      const size_t njobs = grid.size() * nreplicates;
+      table.results.resize(njobs);   // Each job writes its own element
+
+      unsigned n = effective_nthreads(njobs, nthreads);
+      if (workers.size() < n) workers.resize(n);   // Not from within the threads
+      parallel_for_workers(njobs, n, [&](unsigned worker, size_t i) {
+          std::unique_ptr<Simulation>& sim = workers[worker];
+          if (!sim) {
+            sim = factory(worker);
+            assert(sim);
+          }
+          size_t replicate = i % nreplicates;
+          std::uint64_t job_seed = run_seed(seed, common_random_numbers ? replicate : i);
+          table.results[i] = job(*sim, grid[i / nreplicates], replicate, job_seed);
+        });
+      return table;
+    }
+
+    size_t get_nworkers() const { return workers.size(); }
+    /* Discard the simulations; the next run builds new ones */
+    void reset() { workers.clear(); }
+
+  private:
+    Factory factory;
+    unsigned nthreads;
+    std::uint64_t seed;
+    bool common_random_numbers = true;
+    std::vector<std::unique_ptr<Simulation> > workers;
+  };
+
+} // End namespace frantic
+
+#endif // SWEEP_H
@@ -0,0 +1,96 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+/* Minimal checking helpers for the test programme.
+ * Unlike assert, checks are also made in release builds, and a failed check doesn't stop
+ * the programme: it is reported with its location, and counted, so that the remaining
+ * checks still run. main() returns the number of failed checks.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <string>
+
+namespace frantic_tests {
+
+  inline int& nfailures() {
+    static int n = 0;
+    return n;
+  }
+
+  inline void report(bool ok, const char* expr, const char* file, int line, const std::string& details = "") {
+    if (!ok) {
+      ++nfailures();
+      std::fprintf(stderr, "%s:%d: check failed: %s %s\n", file, line, expr, details.c_str());
+    }
+  }
+
+  /* Run a group of checks; exceptions escaping it count as failures */
+  inline void run_group(const char* name, const std::function<void()>& group) {
+    int before = nfailures();
+    try {
+      group();
+    } catch (std::exception& e) {
+      ++nfailures();
+      std::fprintf(stderr, "%s: uncaught exception: %s\n", name, e.what());
+    }
+    std::printf("%-40s %s\n", name, (nfailures() == before) ? "ok" : "FAILED");
+    std::fflush(stdout);
+  }
+
+  /* Directory for the files written by the tests, emptied when the programme starts */
+  inline std::string scratch_directory() {
+    static std::string directory = [] {
+      std::filesystem::path p = std::filesystem::temp_directory_path() / "frantic_test_files";
+      std::filesystem::remove_all(p);
+      std::filesystem::create_directories(p);
+      return p.string();
+    }();
+    return directory;
+  }
+
+  inline std::string read_file(const std::string& filename) {
+    std::ifstream in(filename, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  }
+
+  /* Least squares slope of log(y) against log(x) */
+  template <typename Vector>
+  double log_slope(const Vector& x, const Vector& y) {
+    double mx = 0, my = 0;
+    for (size_t i=0; i < x.size(); ++i) {
+      mx += std::log(x[i]);
+      my += std::log(y[i]);
+    }
+    mx /= x.size();
+    my /= y.size();
+    double sxy = 0, sxx = 0;
+    for (size_t i=0; i < x.size(); ++i) {
+      sxy += (std::log(x[i]) - mx) * (std::log(y[i]) - my);
+      sxx += (std::log(x[i]) - mx) * (std::log(x[i]) - mx);
+    }
+    return sxy / sxx;
+  }
+
+  void storage_tests();
+  void io_tests();
+  void convergence_tests();
+  void parallel_tests();
+
+} // End namespace frantic_tests
+
+#define CHECK(expr) frantic_tests::report(bool(expr), #expr, __FILE__, __LINE__)
+#define CHECK_CLOSE(a, b, tol) \
+  frantic_tests::report(std::abs((a) - (b)) <= (tol), #a " == " #b, __FILE__, __LINE__, \
+                        "(" + std::to_string(a) + " vs " + std::to_string(b) + ")")
+#define CHECK_THROWS(expr, exception) do {                              \
+    bool thrown = false;                                                \
+    try { expr; } catch (exception&) { thrown = true; }                 \
+    frantic_tests::report(thrown, #expr " throws " #exception, __FILE__, __LINE__); \
+  } while (false)
+
+#endif // CHECK_H
@@ -0,0 +1,17 @@
+/* Checks of the integrators library: storage policies, file formats, convergence orders of
+ * the integrators, and the parallel drivers. Returns the number of failed checks.
+ */
+
+#include "check.h"
+
+int main() {
+  frantic_tests::run_group("Storage policies", frantic_tests::storage_tests);
+  frantic_tests::run_group("Text and binary files", frantic_tests::io_tests);
+  frantic_tests::run_group("Convergence orders", frantic_tests::convergence_tests);
+  frantic_tests::run_group("Monte Carlo and parameter sweeps", frantic_tests::parallel_tests);
+
+  if (frantic_tests::nfailures() > 0) {
+    std::fprintf(stderr, "%d check(s) failed\n", frantic_tests::nfailures());
+  }
+  return frantic_tests::nfailures();
+}
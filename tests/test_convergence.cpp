@@ -0,0 +1,264 @@
+/* Convergence orders of the integrators, measured on problems with a known solution.
+ * The one-step methods are run with a fixed step (tolerances so loose that every step is
+ * accepted, and the longest step set to h), and their order is log2 of the error ratio when
+ * h is halved. BDF changes step and order as it goes, so its order is measured from the
+ * error against the number of steps as the tolerance is tightened (error ~ nsteps^-order).
+ * The stochastic integrators are compared with the exact solution for the same Brownian
+ * path, and their strong order measured from the mean error over paths.
+ */
+
+#include <cmath>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <eigen3/Eigen/Dense>
+
+#include "integrators/integrator.h"
+#include "integrators/rkf45_gsl.h"
+#include "integrators/dopri5.h"
+#include "integrators/rosenbrock.h"
+#include "integrators/bdf.h"
+#include "integrators/milstein_sttic.h"
+#include "integrators/sra_sttic.h"
+#include "check.h"
+
+namespace {
+
+  using X1 = Eigen::Matrix<double, 1, 1>;
+  using X2 = Eigen::Matrix<double, 2, 1>;
+
+  /* x' = cos(t) x, with solution exp(sin(t)) */
+  struct Oscillating {
+    using XVector = X1;
+    using XHistory = frantic::InterpolatedSeries<X1, 4, 5>;
+    XVector drift(double t, const XVector& x, const XHistory&) const {
+      return XVector(std::cos(t) * x(0));
+    }
+    static double solution(double t) { return std::exp(std::sin(t)); }
+  };
+
+  template <class Integrator>
+  void start(Integrator& integrator, double tn, double dt) {
+    integrator.history.set_range(0.0, tn, dt);
+    auto initial = std::make_shared<Oscillating::XHistory>();
+    initial->set_range(-1.0, 0.0, 0.1);
+    initial->set([](double t) { return X1::Constant(Oscillating::solution(t)); });
+    integrator.history.set_initial_state(initial);
+  }
+
+  template <template <class> class Integrator>
+  double fixed_step_error(double h) {
+    const double tn = 2;
+    Integrator<Oscillating> integrator;
+    start(integrator, tn, h);
+    integrator.set_tolerances(1e3, 1e3);
+    integrator.set_step_limits(0, h);
+    Oscillating dX;
+    integrator.integrate(dX);
+    return std::abs(integrator.history(tn)(0) - Oscillating::solution(tn));
+  }
+
+  template <template <class> class Integrator>
+  double fixed_step_order(double h) {
+    return std::log2(fixed_step_error<Integrator>(h) / fixed_step_error<Integrator>(h / 2));
+  }
+
+  /* Slope of the maximum error against the number of steps, for tolerances from 'loosest'
+   * down by factors of 10 */
+  double bdf_order(int max_order, double loosest, int ntolerances) {
+    std::vector<double> nsteps, errors;
+    for (int i=0; i < ntolerances; ++i) {
+      double tol = loosest * std::pow(10.0, -i);
+      integrators::BDF<Oscillating> integrator;
+      start(integrator, 10.0, 0.01);
+      integrator.set_tolerances(tol, tol);
+      integrator.set_max_order(max_order);
+      Oscillating dX;
+      integrator.integrate(dX);
+      double error = 0;
+      for (size_t row=0; row < integrator.history.get_nlines(); ++row) {
+        error = std::max(error, std::abs(integrator.history.row(row)(0)
+                                         - Oscillating::solution(integrator.history.time(row))));
+      }
+      nsteps.push_back(integrator.get_naccepted());
+      errors.push_back(error);
+    }
+    return -frantic_tests::log_slope(nsteps, errors);
+  }
+
+  void check_deterministic_orders() {
+    // GSL's RKF45 coefficients advance with the fifth order solution
+    double order = fixed_step_order<integrators::RKF45_gsl>(0.05);
+    CHECK_CLOSE(order, 5.0, 0.3);
+    order = fixed_step_order<integrators::DOPRI5>(0.05);
+    CHECK_CLOSE(order, 5.0, 0.3);
+    order = fixed_step_order<integrators::Rosenbrock23>(0.025);
+    CHECK_CLOSE(order, 2.0, 0.3);
+
+    // Several step and order changes make the measure noisy; the order shouldn't be lower
+    order = bdf_order(1, 1e-3, 5);
+    CHECK(order > 0.7 and order < 2.0);
+    for (int k=2; k <= 5; ++k) {
+      order = bdf_order(k, 1e-5, 6);
+      CHECK(order > k - 0.3 and order < k + 1.0);
+    }
+  }
+
+
+  /* Brownian paths sampled on a fine grid; the increments of a coarser grid, and the
+   * integrals needed by SRA, are computed from those of the fine grid */
+  struct BrownianPath {
+    double tn;
+    size_t nfine;
+    std::vector<double> W;
+
+    BrownianPath(double tn, size_t nfine, std::mt19937_64& generator) : tn(tn), nfine(nfine), W(nfine + 1, 0) {
+      std::normal_distribution<double> normal(0, std::sqrt(tn / nfine));
+      for (size_t i=0; i < nfine; ++i) W[i + 1] = W[i] + normal(generator);
+    }
+    /* Increment over step k of a grid with m fine steps per step */
+    double dW(size_t k, size_t m) const { return W[(k + 1) * m] - W[k * m]; }
+    /* (1/h) * integral of (W(s) - W(t_k)) ds over step k, i.e. I_(1,0) / h (trapezoid rule) */
+    double I10(size_t k, size_t m) const {
+      double sum = 0;
+      for (size_t i=0; i < m; ++i) sum += 0.5 * (W[k * m + i] + W[k * m + i + 1]) - W[k * m];
+      return sum / m;
+    }
+  };
+
+  /* Noise of the stochastic differentials, read from a path */
+  struct PathNoise {
+    const BrownianPath* path = nullptr;
+    size_t m = 1;              // Fine steps per integration step
+    mutable size_t k = 0;      // Current step
+    bool sra = false;          // SRA draws a second differential per step
+    mutable bool second = false;
+    double next(size_t c = 0) const { return path[c].dW(k, m); }
+  };
+
+  /* Geometric Brownian motion with diagonal noise: dx_i = mu_i x_i dt + s_i x_i dW_i,
+   * with solution x_i(t) = exp((mu_i - s_i^2/2) t + s_i W_i(t)) */
+  struct GeometricBrownian {
+    using XVector = X2;
+    using XHistory = frantic::InterpolatedSeries<X2, 1, 3>;
+    using DiffusionCoeff = frantic::Tuple<XVector, XVector>;
+    using DiffusionDifferential = frantic::Tuple<double, double>;
+    double mu[2] = {0.5, -0.3};
+    double s[2] = {0.8, 0.5};
+    PathNoise noise;
+
+    XVector drift(double, const XVector& x, const XHistory&) const {
+      return XVector(mu[0] * x(0), mu[1] * x(1));
+    }
+    DiffusionCoeff diffusion_coeffs(double, const XVector& x, const XHistory&) const {
+      return DiffusionCoeff(XVector(s[0] * x(0), 0), XVector(0, s[1] * x(1)));
+    }
+    DiffusionDifferential diffusion_differentials(double) const {
+      DiffusionDifferential dW(noise.next(0), noise.next(1));
+      ++noise.k;
+      return dW;
+    }
+    XVector solution(const BrownianPath* paths) const {
+      XVector x;
+      for (int i=0; i < 2; ++i) {
+        x(i) = std::exp((mu[i] - 0.5 * s[i] * s[i]) * paths[i].tn + s[i] * paths[i].W.back());
+      }
+      return x;
+    }
+  };
+
+  /* Additive noise: dx = (-x + sin(t)) dt + g(t) dW, with g(t) = 0.7 (1 + 0.5 cos(3t)).
+   * x(t) = exp(-t) x(0) + (sin(t) - cos(t) + exp(-t)) / 2 + integral of exp(s-t) g(s) dW(s),
+   * the stochastic integral being computed on the fine grid (midpoint rule). */
+  struct AdditiveNoise {
+    using XVector = X1;
+    using XHistory = frantic::InterpolatedSeries<X1, 1, 3>;
+    using DiffusionCoeff = frantic::Tuple<XVector>;
+    using DiffusionDifferential = frantic::Tuple<double>;
+    PathNoise noise;
+
+    XVector drift(double t, const XVector& x, const XHistory&) const {
+      return XVector(-x(0) + std::sin(t));
+    }
+    static double g(double t) { return 0.7 * (1 + 0.5 * std::cos(3 * t)); }
+    DiffusionCoeff diffusion_coeffs(double t, const XVector&, const XHistory&) const {
+      return DiffusionCoeff(XVector(g(t)));
+    }
+    /* SRA draws dW, then dU = sqrt(3) (2 I_(1,0)/h - dW) (see sra_sttic.h) */
+    DiffusionDifferential diffusion_differentials(double) const {
+      double dW = noise.next();
+      if (!noise.second) {
+        noise.second = true;
+        return DiffusionDifferential(dW);
+      }
+      noise.second = false;
+      double dU = std::sqrt(3.0) * (2 * noise.path->I10(noise.k, noise.m) - dW);
+      ++noise.k;
+      return DiffusionDifferential(dU);
+    }
+    static double solution(double x0, const BrownianPath& path) {
+      double t = path.tn, h = path.tn / path.nfine;
+      double integral = 0;
+      for (size_t i=0; i < path.nfine; ++i) {
+        double s = (i + 0.5) * h;
+        integral += std::exp(s - t) * g(s) * (path.W[i + 1] - path.W[i]);
+      }
+      return std::exp(-t) * x0 + 0.5 * (std::sin(t) - std::cos(t) + std::exp(-t)) + integral;
+    }
+  };
+
+  template <template <class> class Integrator, class Differential>
+  typename Differential::XVector integrate_path(Differential& dX, size_t nsteps, double tn,
+                                                const typename Differential::XVector& x0) {
+    Integrator<Differential> integrator;
+    integrator.history.set_range(0.0, tn, tn / nsteps);
+    auto initial = std::make_shared<typename Differential::XHistory>();
+    initial->set_range(-1.0, 0.0, 0.5);
+    initial->set([x0](double) { return x0; });
+    integrator.history.set_initial_state(initial);
+    integrator.integrate(dX);
+    return integrator.history.row(integrator.history.get_nlines() - 1);
+  }
+
+  void check_stochastic_orders() {
+    const double tn = 1;
+    const size_t nfine = 1 << 14;
+    const size_t npaths = 200;
+    const std::vector<double> nsteps = {8, 16, 32, 64};
+    std::vector<double> milstein_errors(nsteps.size(), 0), sra_errors(nsteps.size(), 0);
+
+    std::mt19937_64 generator(2016);
+    for (size_t p=0; p < npaths; ++p) {
+      BrownianPath paths[2] = {BrownianPath(tn, nfine, generator), BrownianPath(tn, nfine, generator)};
+      double sra_solution = AdditiveNoise::solution(0.2, paths[0]);
+      for (size_t i=0; i < nsteps.size(); ++i) {
+        size_t m = nfine / size_t(nsteps[i]);
+
+        GeometricBrownian gbm;
+        gbm.noise.path = paths;
+        gbm.noise.m = m;
+        X2 x = integrate_path<integrators::Milstein_sttic>(gbm, size_t(nsteps[i]), tn, X2(1, 1));
+        milstein_errors[i] += (x - gbm.solution(paths)).norm() / npaths;
+
+        AdditiveNoise additive;
+        additive.noise.path = paths;
+        additive.noise.m = m;
+        X1 y = integrate_path<integrators::SRA_sttic>(additive, size_t(nsteps[i]), tn, X1(0.2));
+        sra_errors[i] += std::abs(y(0) - sra_solution) / npaths;
+      }
+    }
+
+    // Strong orders: 1 for Milstein, 1.5 for SRA
+    double order = -frantic_tests::log_slope(nsteps, milstein_errors);
+    CHECK(order > 0.8 and order < 1.4);
+    order = -frantic_tests::log_slope(nsteps, sra_errors);
+    CHECK(order > 1.3 and order < 2.3);
+  }
+
+} // End anonymous namespace
+
+void frantic_tests::convergence_tests() {
+  check_deterministic_orders();
+  check_stochastic_orders();
+}
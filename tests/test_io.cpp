@@ -0,0 +1,189 @@
+/* File formats: a series written as text or binary and read back is the same series, with
+ * every storage policy that can read it; so is a collection of histograms.
+ */
+
+#include <array>
+#include <cctype>
+#include <cmath>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include <eigen3/Eigen/Dense>
+
+#include "integrators/history.h"
+#include "integrators/histcollection.h"
+#include "integrators/sinks.h"
+#include "check.h"
+
+namespace {
+
+  using X3 = Eigen::Matrix<double, 3, 1>;
+  using X2 = Eigen::Matrix<double, 2, 1>;
+
+  /* Rows with values over many orders of magnitude, and times that aren't round numbers */
+  void fill(frantic::Series<X3, frantic::ContiguousStorage>& series, size_t nrows) {
+    std::mt19937_64 generator(11);
+    std::normal_distribution<double> normal;
+    series.set_range(0.0, (nrows - 1) * 0.001, 0.001);
+    series.set_initial_state(X3(normal(generator), 1e-7 * normal(generator), 1e9 * normal(generator)));
+    for (size_t i=1; i < nrows; ++i) {
+      X3 x(normal(generator), 1e-7 * normal(generator), 1e9 * normal(generator));
+      series.update(i * 0.001, x);
+    }
+  }
+
+  template <typename Series1, typename Series2>
+  bool same_rows(const Series1& a, const Series2& b) {
+    if (a.get_nlines() != b.get_nlines()) return false;
+    for (size_t i=0; i < a.get_nlines(); ++i) {
+      for (size_t j=0; j < a.get_ncolumns(); ++j) {
+        if (a.get(j, i) != b.get(j, i)) return false;
+      }
+    }
+    return true;
+  }
+
+  /* True if 'rounded' is 'exact' with every number written as 'out << value' would, i.e.
+   * with 6 significant digits. Files are compared word by word; words which aren't numbers
+   * must be identical. */
+  bool rounded_to_6_digits(const std::string& exact, const std::string& rounded) {
+    std::istringstream exact_in(exact), rounded_in(rounded);
+    std::string a, b;
+    while (exact_in >> a) {
+      if (!(rounded_in >> b)) return false;
+      size_t end = 0;
+      double value = 0;
+      // Not words such as "info", which stod reads as inf, or "--"
+      if (std::isdigit(a[0]) or (a[0] == '-' and a.size() > 1 and std::isdigit(a[1]))) {
+        value = std::stod(a, &end);
+      }
+      if (end == 0) {
+        if (a != b) return false;
+        continue;
+      }
+      std::ostringstream text;
+      text << value << a.substr(end);
+      if (text.str() != b) return false;
+    }
+    return !(rounded_in >> b);
+  }
+
+  void check_text_round_trip() {
+    const std::string directory = frantic_tests::scratch_directory();
+    frantic::Series<X3, frantic::ContiguousStorage> series("x", 10);
+    fill(series, 20000);
+
+    // Numbers are written in shortest round-trip form, so reading back is exact
+    for (std::string format : {", ", " ", "org"}) {
+      std::string filename = "series_" + std::to_string(format.size()) + ".txt";
+      series.dump_to_text("x", true, format, 100, 4)(directory, filename);
+      frantic::Series<X3> text;
+      text.read_from_text(directory, filename, format);
+      CHECK(same_rows(series, text));
+      CHECK(text.get_column_name(3) == "x3");
+    }
+
+    // Formatting on several threads gives the same file
+    series.dump_to_text("x", true, ", ", 100, 1)(directory, "serial.txt");
+    series.dump_to_text("x", true, ", ", 100, 0)(directory, "parallel.txt");
+    CHECK(frantic_tests::read_file(directory + "/serial.txt") == frantic_tests::read_file(directory + "/parallel.txt"));
+
+    // With a precision, numbers are written as 'out << value' would with that precision
+    series.dump_to_text("x", false, " ", 100, 1, 6)(directory, "precision.txt");
+    frantic::Series<X3> rounded;
+    rounded.read_from_text(directory, "precision.txt", " ");
+    CHECK(rounded.get_nlines() == series.get_nlines());
+    bool same = true;
+    for (size_t i=0; i < series.get_nlines() and i < rounded.get_nlines(); ++i) {
+      for (size_t j=0; j < series.get_ncolumns(); ++j) {
+        std::ostringstream text;
+        text << series.get(j, i);
+        same = same and rounded.get(j, i) == std::stod(text.str());
+      }
+    }
+    CHECK(same);
+
+    // A text sink writes the same file as dump_to_text, precision included
+    frantic::Series<X3, frantic::ContiguousStorage> spilled("x", 10);
+    auto sink = std::make_shared<frantic::SpillToText<X3> >(directory, "spilled.txt", 1000, true, " ", 100, 6);
+    spilled.add_sink(sink);
+    fill(spilled, 5000);
+    sink->close();
+    spilled.dump_to_text("x", true, " ", 100, 1, 6)(directory, "dumped.txt");
+    std::string text = frantic_tests::read_file(directory + "/spilled.txt");
+    CHECK(!text.empty());
+    CHECK(text == frantic_tests::read_file(directory + "/dumped.txt"));
+  }
+
+  void check_binary_round_trip() {
+    const std::string directory = frantic_tests::scratch_directory();
+    frantic::Series<X3, frantic::ContiguousStorage> series("x", 10);
+    fill(series, 20001);    // Odd number of rows: the columns of the file are not aligned
+    series.dump_to_binary("x")(directory, "series.bin");
+
+    frantic::Series<X3> table;
+    table.read_from_binary(directory, "series.bin");
+    frantic::Series<X3, frantic::ContiguousStorage> contiguous;
+    contiguous.read_from_binary(directory, "series.bin");
+    frantic::Series<X3, frantic::MappedStorage> mapped;
+    mapped.read_from_binary(directory, "series.bin");
+
+    CHECK(same_rows(series, table));
+    CHECK(same_rows(series, contiguous));
+    CHECK(same_rows(series, mapped));
+    CHECK(mapped.t0 == series.t0 and mapped.dt == series.dt and mapped.nSteps == series.nSteps);
+    CHECK(mapped.get_column_name(2) == "x2");
+    CHECK(mapped(series.time(1234)) == X3(series.row(1234)));
+    CHECK(mapped.column(2) == series.column(2));
+    CHECK(mapped.times() == series.times());
+    CHECK_THROWS(mapped.line_of_data(100.0, X3::Zero()), std::logic_error);
+
+    // A file with another number of components is rejected
+    frantic::Series<X2> other;
+    CHECK_THROWS(other.read_from_binary(directory, "series.bin"), std::runtime_error);
+  }
+
+  void check_histograms_round_trip() {
+    const std::string directory = frantic_tests::scratch_directory();
+    frantic::HistCollection<X2> density;
+    density.set_binning([](double t, size_t c) { return std::array<double, 2>{-3.0 - t - c, 3.0 + t}; }, 16);
+    std::mt19937_64 generator(5);
+    std::normal_distribution<double> normal;
+    for (int snapshot=0; snapshot < 10; ++snapshot) {
+      for (int i=0; i < 500; ++i) {
+        density.update(0.5 * snapshot, X2(normal(generator), 2 * normal(generator)), 0.1 + i % 3);
+      }
+    }
+    // Outliers extend one histogram on each side: records of the others are padded
+    density.update(1.5, X2(-20, 30));
+    density.dump_to_binary(directory, "density.bin", 100, 0, 0.5, 9);
+
+    frantic::HistCollection<X2> read;
+    frantic::BinaryHeader header = read.read_from_binary(directory, "density.bin");
+    CHECK(header.kind == frantic::BinaryHeader::HISTOGRAMS);
+    CHECK(header.nrows == 10 and header.nbins > 16);
+    CHECK(header.dt == 0.5 and header.nSteps == 9);
+
+    // Text files are exact, so the collections are the same if their text is
+    density.dump_to_text(directory, "density.txt");
+    read.dump_to_text(directory, "read.txt");
+    std::string text = frantic_tests::read_file(directory + "/density.txt");
+    CHECK(!text.empty());
+    CHECK(text == frantic_tests::read_file(directory + "/read.txt"));
+
+    density.dump_to_text(directory, "density_6.txt", true, " ", 100, 1, 6);
+    std::string rounded = frantic_tests::read_file(directory + "/density_6.txt");
+    CHECK(rounded != text);
+    density.dump_to_text(directory, "density_exact.txt", true, " ");
+    CHECK(rounded_to_6_digits(frantic_tests::read_file(directory + "/density_exact.txt"), rounded));
+  }
+
+} // End anonymous namespace
+
+void frantic_tests::io_tests() {
+  check_text_round_trip();
+  check_binary_round_trip();
+  check_histograms_round_trip();
+}
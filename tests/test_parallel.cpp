@@ -0,0 +1,158 @@
+/* Parallel drivers: MonteCarlo and ParameterSweep give the same results whatever the number
+ * of threads, since the seed of a run only depends on its index.
+ */
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <eigen3/Eigen/Dense>
+
+#include "integrators/integrator.h"
+#include "integrators/stochastic.h"
+#include "integrators/euler_sttic.h"
+#include "integrators/histcollection.h"
+#include "integrators/statistics.h"
+#include "integrators/montecarlo.h"
+#include "integrators/sweep.h"
+#include "check.h"
+
+namespace {
+
+  using X1 = Eigen::Matrix<double, 1, 1>;
+
+  /* Delayed Ornstein-Uhlenbeck process: dx = alpha x(t - tau) dt + sqrt(2D) dW */
+  struct DelayedOU {
+    using XVector = X1;
+    using XHistory = frantic::InterpolatedSeries<X1, 1, 3>;
+    using DiffusionCoeff = frantic::Tuple<XVector>;
+    using DiffusionDifferential = frantic::Tuple<double>;
+
+    frantic::Parameter<double> alpha{"alpha", "α", -1}, tau{"tau", "τ", 1}, D{"D", "D", 1};
+    frantic::ParameterTuple<false, frantic::Parameter<double>, frantic::Parameter<double>,
+                            frantic::Parameter<double> > parameters{alpha, tau, D};
+    frantic::GaussianWhiteNoise<double> noise;
+
+    XVector drift(double t, const XVector&, const XHistory& history) const {
+      return alpha.value * history(t - tau.value);
+    }
+    DiffusionCoeff diffusion_coeffs(double, const XVector&, const XHistory&) const {
+      return DiffusionCoeff(XVector::Constant(std::sqrt(2 * D.value)));
+    }
+    DiffusionDifferential diffusion_differentials(double dt) const {
+      return DiffusionDifferential(noise(dt));
+    }
+  };
+
+  struct Simulation {
+    integrators::Euler_sttic<DelayedOU> integrator;
+    DelayedOU dX;
+    frantic::HistCollection<X1> density;
+    frantic::RunningStatistics<X1> statistics{true};
+
+    Simulation() {
+      density.set_binning([](double, size_t) { return std::array<double, 2>{-4, 4}; }, 20);
+    }
+    void run(std::uint64_t seed) {
+      dX.noise.seed(seed);
+      integrator.reset();
+      integrator.history.set_range(0.0, 5.0, 0.01);
+      auto initial = std::make_shared<DelayedOU::XHistory>();
+      initial->set_range(-2.0, 0.0, 0.01);
+      initial->set([](double) { return X1::Constant(0); });
+      integrator.history.set_initial_state(initial);
+      integrator.history.register_delay(dX.tau.value);
+      integrator.integrate(dX);
+      for (int t=1; t < 5; ++t) density.update(t, integrator.history(t));
+      statistics.update(final_state());
+    }
+    /* Last row: times are accumulated step by step, so may end slightly before tn */
+    X1 final_state() const {
+      return integrator.history.row(integrator.history.get_nlines() - 1);
+    }
+  };
+
+  struct MonteCarloResults {
+    std::vector<double> finals;   // By run
+    std::string density;          // Merged density, as text
+    frantic::RunningStatistics<X1> statistics;
+  };
+
+  MonteCarloResults run_monte_carlo(unsigned nthreads) {
+    const size_t nruns = 200;
+    MonteCarloResults results;
+    results.finals.resize(nruns);
+    frantic::MonteCarlo<Simulation> mc([](unsigned) { return std::make_unique<Simulation>(); }, nthreads, 42);
+    auto run = [&results](Simulation& sim, size_t i, std::uint64_t seed) {
+      sim.run(seed);
+      results.finals[i] = sim.final_state()(0);   // Each run writes its own element
+    };
+    // Runs are numbered across calls, so two calls do the same as one
+    mc.run(nruns / 2, run);
+    mc.run(nruns - nruns / 2, run);
+
+    frantic::HistCollection<X1> density = mc.merge([](const Simulation& sim) -> const frantic::HistCollection<X1>& {
+        return sim.density; });
+    std::string filename = "montecarlo_" + std::to_string(nthreads) + ".txt";
+    density.dump_to_text(frantic_tests::scratch_directory(), filename);
+    results.density = frantic_tests::read_file(frantic_tests::scratch_directory() + "/" + filename);
+    results.statistics = mc.merge([](const Simulation& sim) -> const frantic::RunningStatistics<X1>& {
+        return sim.statistics; });
+    return results;
+  }
+
+  void check_monte_carlo() {
+    MonteCarloResults serial = run_monte_carlo(1);
+    CHECK(!serial.density.empty());
+    for (unsigned nthreads : {2u, 3u, 4u}) {
+      MonteCarloResults parallel = run_monte_carlo(nthreads);
+      CHECK(parallel.finals == serial.finals);
+      // Bin counts are integers, so the merged density is exact in any order
+      CHECK(parallel.density == serial.density);
+      // Statistics are merged in another order: equal up to rounding
+      CHECK(parallel.statistics.count() == serial.statistics.count());
+      CHECK_CLOSE(parallel.statistics.mean()(0), serial.statistics.mean()(0), 1e-12);
+      CHECK_CLOSE(parallel.statistics.variance()(0), serial.statistics.variance()(0), 1e-12);
+    }
+  }
+
+  frantic::ParameterGrid sweep_grid() {
+    frantic::ParameterGrid grid;
+    grid.add_axis("alpha", {-0.5, -1.0}).add_axis("tau", frantic::ParameterGrid::linspace(0.5, 1.5, 3));
+    grid.add_point({{"alpha", -1.4}, {"tau", 1.0}});
+    return grid;
+  }
+
+  frantic::SweepResults<double> run_sweep(unsigned nthreads, bool common_random_numbers) {
+    frantic::ParameterSweep<Simulation> sweep([](unsigned) { return std::make_unique<Simulation>(); }, nthreads, 7);
+    sweep.set_common_random_numbers(common_random_numbers);
+    return sweep.run(sweep_grid(), 5, [](Simulation& sim, const frantic::ParameterPoint& point, size_t,
+                                         std::uint64_t seed) {
+        frantic::apply_point(point, sim.dX.parameters);
+        sim.run(seed);
+        return sim.final_state()(0);
+      });
+  }
+
+  void check_parameter_sweep() {
+    frantic::SweepResults<double> serial = run_sweep(1, true);
+    CHECK(serial.npoints() == 7 and serial.results.size() == 35);
+    CHECK(serial.grid[3][0].second == -1.0 and serial.grid[3][1].second == 0.5);
+    for (unsigned nthreads : {2u, 3u, 0u}) {
+      CHECK(run_sweep(nthreads, true).results == serial.results);
+      CHECK(run_sweep(nthreads, false).results == run_sweep(1, false).results);
+    }
+    // The parameters are applied: points differ, as do replicates
+    CHECK(serial(0, 0) != serial(1, 0));
+    CHECK(serial(0, 0) != serial(0, 1));
+  }
+
+} // End anonymous namespace
+
+void frantic_tests::parallel_tests() {
+  check_monte_carlo();
+  check_parameter_sweep();
+}
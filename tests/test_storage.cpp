@@ -0,0 +1,155 @@
+/* Storage policies: the same rows stored with each policy read back identically, and
+ * RingStorage only keeps the rows its retention window asks for.
+ */
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include <eigen3/Eigen/Dense>
+
+#include "integrators/history.h"
+#include "integrators/RK4.h"
+#include "check.h"
+
+namespace {
+
+  using X2 = Eigen::Matrix<double, 2, 1>;
+  using X1 = Eigen::Matrix<double, 1, 1>;
+
+  X2 state(double t) { return X2(std::sin(t), std::cos(3 * t)); }
+
+  template <template <typename> class Storage>
+  void check_policy() {
+    const size_t nrows = 1000;
+    frantic::Series<X2, Storage> series("x", 10);
+    series.set_range(0.0, 1.0, 1.0 / (nrows - 1));
+    series.set_initial_state(state(0));
+    for (size_t i=1; i < nrows; ++i) {
+      series.update(i / double(nrows - 1), state(i / double(nrows - 1)));
+    }
+
+    CHECK(series.get_nlines() == nrows);
+    CHECK(series.get_ncolumns() == 3);
+    CHECK(series.first_line() == 0);
+    bool same = true;
+    for (size_t i=0; i < nrows; ++i) {
+      double t = i / double(nrows - 1);
+      X2 row = series.row(i);
+      same = same and series.time(i) == t and series.get(0, i) == t and row == state(t)
+        and series.get(1, i) == state(t)(0) and series.get(2, i) == state(t)(1);
+    }
+    CHECK(same);
+
+    CHECK(series.get_column_name(0) == "t");
+    CHECK(series.get_column_name(2) == "x2");
+    CHECK(series.column_index("x1") == 1);
+
+    // Lookup by exact time
+    CHECK(series.getVectorAtTime(series.time(500)) == state(series.time(500)));
+    CHECK_THROWS(series.getVectorAtTime(0.5 * (series.time(500) + series.time(501))), std::out_of_range);
+    CHECK_THROWS(series.getVectorAtTime(2.0), std::out_of_range);
+  }
+
+  void check_ring_retention() {
+    // Keep rows within 1 of the latest time, plus 2 before those
+    frantic::RingStorage<X1> ring(4);
+    ring.set_retention(1.0, 2);
+    const double dt = 0.1;
+    const size_t nrows = 10000;
+    for (size_t i=0; i < nrows; ++i) {
+      ring.append_row(i * dt, X1(double(i)));
+    }
+    CHECK(ring.get_nlines() == nrows);
+    CHECK(ring.get_capacity() <= 32);     // 10 rows in the window, 2 extra and the newest
+    size_t first = ring.first_line();
+    CHECK(first > 0);
+    // Every row needed is still there, with its absolute index...
+    double window_start = (nrows - 1) * dt - 1.0;
+    CHECK(first + 2 <= size_t(window_start / dt + 1e-9));
+    bool same = true;
+    for (size_t i=first; i < nrows; ++i) {
+      same = same and ring.time(i) == i * dt and ring.row(i)(0) == double(i);
+    }
+    CHECK(same);
+    // ...but older ones are gone
+    CHECK_THROWS(ring.row(first - 1), std::out_of_range);
+    CHECK_THROWS(ring.time(0), std::out_of_range);
+
+    // Without a retention window, nothing is discarded
+    frantic::RingStorage<X1> all(4);
+    for (size_t i=0; i < 100; ++i) {
+      all.append_row(i * dt, X1(double(i)));
+    }
+    CHECK(all.first_line() == 0);
+    CHECK(all.row(0)(0) == 0);
+
+    // Rows within the window are never overwritten: the buffer grows instead
+    frantic::RingStorage<X1> growing(4);
+    growing.set_retention(1e9, 0);
+    for (size_t i=0; i < 100; ++i) {
+      growing.append_row(i * dt, X1(double(i)));
+    }
+    CHECK(growing.first_line() == 0);
+    CHECK(growing.get_capacity() >= 100);
+  }
+
+  /* x'(t) = -x(t - 1), x = 1 for t <= 0 */
+  template <template <typename> class Storage>
+  struct DelayedDecay {
+    using XVector = X1;
+    using XHistory = frantic::InterpolatedSeries<X1, 3, 4, Storage>;
+    XVector drift(double t, const XVector&, const XHistory& history) const {
+      return -history(t - 1);
+    }
+  };
+
+  double delayed_decay_solution(double t) {
+    return 1 - t + (t - 1) * (t - 1) / 2 - (t - 2) * (t - 2) * (t - 2) / 6;   // For 2 <= t <= 3
+  }
+
+  template <template <typename> class Storage>
+  void integrate_delayed_decay(integrators::RK4<DelayedDecay<Storage> >& integrator, double tn) {
+    using XHistory = typename DelayedDecay<Storage>::XHistory;
+    DelayedDecay<Storage> dX;
+    integrator.history.set_range(0.0, tn, 0.01);
+    auto initial = std::make_shared<XHistory>();
+    initial->set_range(-2.0, 0.0, 0.01);
+    initial->set([](double) { return X1::Constant(1); });
+    integrator.history.set_initial_state(initial);
+    integrator.history.register_delay(1.0);
+    integrator.history.add_discontinuity(0);
+    integrator.integrate(dX);
+  }
+
+  /* A delayed system integrated with RingStorage gives the same results as with the default
+   * storage, keeping only about a delay's worth of rows */
+  void check_ring_integration() {
+    integrators::RK4<DelayedDecay<frantic::TableStorage> > table;
+    integrators::RK4<DelayedDecay<frantic::RingStorage> > ring;
+    integrate_delayed_decay(table, 3.0);
+    integrate_delayed_decay(ring, 3.0);
+
+    size_t nlines = table.history.get_nlines();
+    CHECK(ring.history.get_nlines() == nlines);
+    CHECK(ring.history.first_line() > 0);
+    CHECK(ring.history.get_capacity() < nlines);
+    bool same = true;
+    for (size_t i=ring.history.first_line(); i < nlines; ++i) {
+      same = same and ring.history.time(i) == table.history.time(i)
+        and ring.history.row(i) == table.history.row(i);
+    }
+    CHECK(same);
+    CHECK_CLOSE(ring.history(2.5)(0), delayed_decay_solution(2.5), 1e-8);
+    CHECK_CLOSE(ring.history(3.0)(0), delayed_decay_solution(3.0), 1e-8);
+  }
+
+} // End anonymous namespace
+
+void frantic_tests::storage_tests() {
+  check_policy<frantic::TableStorage>();
+  check_policy<frantic::ContiguousStorage>();
+  check_policy<frantic::RingStorage>();
+  check_ring_retention();
+  check_ring_integration();
+}
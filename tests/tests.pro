@@ -0,0 +1,35 @@
+#-------------------------------------------------
+#
+# Checks of the integrators library.
+# Build and run with
+#     qmake && make check
+# The programme returns the number of failed checks.
+#
+#-------------------------------------------------
+
+TARGET = frantic_tests
+TEMPLATE = app
+CONFIG += console thread testcase
+CONFIG -= qt app_bundle
+
+QMAKE_CXXFLAGS += -std=c++17
+
+DEFINES += O2SCL_CPP11
+
+INCLUDEPATH += ..          # Headers are included as "integrators/..."
+DEPENDPATH += ..
+
+SOURCES += \
+    main.cpp \
+    test_storage.cpp \
+    test_io.cpp \
+    test_convergence.cpp \
+    test_parallel.cpp \
+    ../integrators/io.cpp
+
+HEADERS += \
+    check.h
+
+# O2scl library
+
+LIBS += -lo2scl
@@ -5,6 +5,7 @@
 
 #include <assert.h>
 #include <string>
+#include <utility>         // Required for std::declval
 #include <vector>
 #include <QVector>
 #include <QString>
@@ -53,6 +54,31 @@ namespace frantic {
       this->setPen(color);
     }
 
+    /* Curve from the stored rows of a Series with a storage policy other than TableStorage
+     * (e.g. ContiguousStorage, or RingStorage, of which only the rows still held are plotted).
+     * Any type providing get(icol, row), get_nlines(), first_line() and get_column_name(icol)
+     * can be used. Data is copied.
+     */
+    template <typename Series, typename = decltype(std::declval<const Series&>().first_line())>
+    Curve(const Series& series, size_t xcol, size_t ycol,
+          const QColor& color=Qt::black, const std::string& style="")
+    {
+      assert(xcol != ycol);
+      size_t first = series.first_line();
+      size_t nlines = series.get_nlines();
+      QVector<double> Qxdata(nlines - first);
+      QVector<double> Qydata(nlines - first);
+      for (size_t i=first; i < nlines; ++i) {
+        Qxdata[i - first] = series.get(xcol, i);
+        Qydata[i - first] = series.get(ycol, i);
+      }
+      this->setSamples(Qxdata, Qydata);
+
+      this->ylabel = QString::fromStdString(series.get_column_name(ycol));
+      this->xlabel = QString::fromStdString(series.get_column_name(xcol));
+      this->setPen(color);
+    }
+
     QString xlabel;
     QString ylabel;
     QString name;      // Internal reference name
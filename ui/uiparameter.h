@@ -90,7 +90,7 @@ namespace frantic {
   class InfoUIParameter : public UIParameter<T>
   {
   protected:
-    QLabel* contentWidget;
+    QLabel* contentWidget = nullptr;   // Until attached; parameters can be used without a UI
 
   public:
     using super = UIParameter<T>;
@@ -116,7 +116,7 @@ namespace frantic {
 
     InfoUIParameter& operator= (const T new_value) {
       value = new_value;
-      contentWidget->setText(super::get_QString());
+      if (contentWidget) contentWidget->setText(super::get_QString());
       return *this;
     }
 
@@ -132,7 +132,7 @@ namespace frantic {
   class InputUIParameter : public UIParameter<T>
   {
   protected:
-    QLineEdit* contentWidget;
+    QLineEdit* contentWidget = nullptr;   // Until attached; parameters can be used without a UI
 
   public:
     using super = UIParameter<T>;
@@ -167,12 +167,12 @@ namespace frantic {
 
     // Always call this before pulling UI values, in case user changed boxes
     void refresh() {
-      UIParameter<T>::set(contentWidget->text());
+      if (contentWidget) UIParameter<T>::set(contentWidget->text());
     }
 
     InputUIParameter& operator= (const T new_value) {
       value = new_value;
-      contentWidget->setText(super::get_QString());
+      if (contentWidget) contentWidget->setText(super::get_QString());
       return *this;
     }
 